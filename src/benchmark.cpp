@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <vector>
+
+#include "misc.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+using namespace std;
+
+namespace
+{
+
+	const vector<string> Defaults = {
+		"rnbakabnr/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w - - 0 1",
+		"2bakab1r/9/2c3nc1/2p1p3p/pn4C2/9/P1P1P1P1P/N3C4/8R/1NBAKAB2 w - - 0 1",
+		"2bakab1r/9/9/2p1p3p/p1c2NCn1/9/P2RP1P1c/4C4/9/2BAKAB2 w - - 0 1",
+		"2ba1ab2/5k3/9/2p1r1C1p/p2RN4/6C2/P3P1P1c/9/9/2BAKAB2 w - - 0 1",
+		"2ba1aC2/5k3/9/4R3p/p8/6C2/P4rP2/8B/4A4/2BAK3c w - - 0 1",
+		"1rbakab1r/9/n3c3n/p3p3p/6C2/2p6/P3P1c1P/2C6/8R/RNBAKABN1 w - - 0 1",
+		"3akab1r/9/n3b3n/p5c1p/4p4/9/P1p1P1R1P/R3B4/8C/1r1AKABN1 w - - 0 1",
+		"3akab2/1n7/4b4/p1c3n1p/9/9/P1R1P3P/R3B1N2/4A1r1C/1rB1KA3 w - - 0 1",
+		"4kab2/1n2a4/4b4/p7p/9/5R3/P3P3P/7c1/5K2C/2rA1A3 w - - 0 1",
+		"2b1ka3/4a4/4b4/9/7P1/1n7/4r4/3R5/4A4/3AK4 w - - 0 1",
+		"r1bakab1r/9/1cn1c4/p3n1N1p/6p2/2p6/P3P1P1P/1C4C2/4A4/R1BAK1BNR w - - 0 1",
+		"r1bak1b1r/4a4/c8/8p/p5n2/2N6/P1n1P1P1P/4C4/4A4/2BAK1BNR w - - 0 1",
+		"2ba1kb1r/4a4/5c3/3r4p/p4N3/9/P3P1PnP/N4A1CR/2n6/2BA1KB2 w - - 0 1",
+		"rnbakabn1/2c6/9/p1Nrp1p1p/9/2c4C1/P3P1P1P/B3C4/9/R2AKABNR w - - 0 1",
+		"1nb1kab2/r1c1a4/8n/p1N1p1p1p/9/4C4/P3P1P1P/B2r5/4N4/R2AKABR1 w - - 0 1",
+		"4kab2/r1c1a4/4R3n/p3p1p2/8p/6P2/P3PN2P/B8/9/2RAKAB2 w - - 0 1",
+		"3rkab2/4a4/8n/4R1p2/8R/p5P2/P3PN2P/9/4A4/2BAK1B2 w - - 0 1",
+		"9/3ka4/3a5/9/4R4/P2R1NP2/4P3P/2r6/4A4/2B1K1B2 w - - 0 1",
+		"2N6/3k5/7R1/9/9/P5P2/4P3P/9/9/2B1KAB2 w - - 0 1",
+		"2bakabnr/5N3/cc7/p5p1p/1rC6/6P2/n1P1P3P/C8/9/RNBAKAB1R w - - 0 1",
+		"2b1kab2/4aN3/1c2c3n/p5p1p/1n2C4/6P2/2P1P3P/B8/7R1/RN1AKAB2 w - - 0 1",
+		"2b1kab2/6n2/3a2R2/2c3p2/R4C2p/2B1P1P2/2P1Nn2P/9/4A4/4KAB2 w - - 0 1",
+		"2b1ka3/9/5a1R1/9/R4C2p/2B1P1P2/2P2c2P/3A2N2/4K1n2/5AB2 w - - 0 1",
+		"5a3/4k4/R4ac2/9/5CN1p/2B1P1P2/2P5P/3A5/4K2R1/5AB2 w - - 0 1",
+		"2baka1nr/4n4/4c3b/p1p1p1pRp/9/8C/PrP1P1P1P/8C/1c2N4/RNBAKAB2 w - - 0 1",
+		"2b1ka3/4a4/6n2/p1p6/2c1n4/4r4/P5P1P/1R2N1N2/4K4/3A1AB2 w - - 0 1",
+		"2b1ka3/4a4/9/p1p6/5P3/2n1r4/P7P/n5N2/4AK3/3A2B2 w - - 0 1",
+		"1nbaka1r1/9/3cc1n1b/p1p1p1p1p/9/9/P1P1P1P1P/2C1B1C2/3NA4/4KABNR w - - 0 1",
+		"1nbaka3/9/3c2c1b/pC2p3p/6p2/2B6/P1P1P3P/4nA2R/3N1r3/4KABN1 w - - 0 1",
+		"r1bakab1r/9/9/4p4/pCP5p/P8/n3P1P1P/N1c6/2R6/2BAKAB1R w - - 0 1",
+		"2baka3/9/4b3r/4p2R1/r7p/9/nCR1P1P1P/N8/4A4/4KAB2 w - - 0 1",
+		"3a1k3/4a4/b3r4/9/2b1C3R/r8/n1R1P1P1P/N8/4A4/4KAB2 w - - 0 1",
+		"3a1k3/4a4/b8/9/9/4R1C2/r3P1P1P/9/4A4/4KAB2 w - - 0 1",
+		"9/5k3/3a1a3/9/2b1P4/3C5/4P3P/3KBA3/9/3A5 w - - 0 1"
+	};
+
+} // namespace
+
+/// benchmark() runs a simple benchmark by letting the engine analyze a
+/// set of positions for a given limit each. There are five parameters: the
+/// transposition table size, the number of search threads that should
+/// be used, the limit value spent for each position (optional, default is
+/// depth 13), an optional file name where to look for positions in FEN
+/// format (defaults are the positions defined above, "current" is the
+/// position on the board) and the type of the limit value: depth (default),
+/// perft, time in millisecs, number of nodes or mate in moves.
+
+void benchmark(const Position& current, istream& is)
+{
+	string token;
+	vector<string> fens;
+	Search::LimitsType limits;
+
+	// Assign default values to missing arguments
+	string ttSize = (is >> token) ? token : "16";
+	string threads = (is >> token) ? token : "1";
+	string limit = (is >> token) ? token : "13";
+	string fenFile = (is >> token) ? token : "default";
+	string limitType = (is >> token) ? token : "depth";
+
+	Options["Hash"] = ttSize;
+	Options["Threads"] = threads;
+	Search::clear();
+
+#if defined(TT_STATS)
+	TT.reset_stats();
+#endif
+
+	if (limitType == "time")
+		limits.movetime = stoi(limit); // movetime is in millisecs
+
+	else if (limitType == "nodes")
+		limits.nodes = stoll(limit);
+
+	else if (limitType == "mate")
+		limits.mate = stoi(limit);
+
+	else if (limitType == "perft")
+		limits.perft = stoi(limit);
+
+	else
+		limits.depth = stoi(limit);
+
+	if (fenFile == "default")
+		fens = Defaults;
+
+	else if (fenFile == "current")
+		fens.push_back(current.fen());
+
+	else
+	{
+		string fen;
+		ifstream file(fenFile);
+
+		if (!file.is_open())
+		{
+			cerr << "Unable to open file " << fenFile << endl;
+			return;
+		}
+
+		while (getline(file, fen))
+			if (!fen.empty())
+				fens.push_back(fen);
+
+		file.close();
+	}
+
+	uint64_t nodes = 0;
+	TimePoint elapsed = now(), latency = 0, maxLatency = 0;
+	int stops = 0;
+	Position pos;
+
+	for (size_t i = 0; i < fens.size(); ++i)
+	{
+		StateListPtr states(new std::deque<StateInfo>(1));
+		pos.set(fens[i], &states->back(), Threads.main());
+
+		cerr << "\nPosition: " << i + 1 << '/' << fens.size() << endl;
+
+		limits.startTime = now();
+		Threads.start_thinking(pos, states, limits);
+		Threads.main()->wait_for_search_finished();
+		nodes += limits.perft ? Threads.perft_nodes() : Threads.nodes_searched();
+
+		// Time from the timer raising the stop signal to the best move
+		if (Threads.main()->timerFired)
+		{
+			TimePoint l = now() - Threads.main()->timerFired;
+			latency += l, maxLatency = std::max(maxLatency, l), ++stops;
+		}
+	}
+
+	elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+	if (limits.perft)
+		cerr << "\n==========================="
+			<< "\nTotal time (ms) : " << elapsed
+			<< "\nLeaves counted  : " << nodes
+			<< "\nLeaves/second   : " << 1000 * nodes / elapsed << endl;
+	else
+		cerr << "\n==========================="
+			<< "\nTotal time (ms) : " << elapsed
+			<< "\nNodes searched  : " << nodes
+			<< "\nNodes/second    : " << 1000 * nodes / elapsed
+			<< "\nTT hits         : " << Threads.tt_hits() << " ("
+			<< 100.0 * Threads.tt_hits() / std::max(Threads.tt_probes(), uint64_t(1))
+			<< "% of " << Threads.tt_probes() << " probes)"
+			<< "\nSlider lookups  : " << Bitboards::index_backend()
+			<< "\nQSearch table   : " << (Options["QSearch Hash"] ? "on" : "off")
+			<< "\nNUMA nodes      : " << numa_node_count()
+			<< (Threads.bindThreads ? ", threads bound" : ", threads not bound")
+			<< "\nEval cache hits : " << Threads.eval_cache_hits() << " ("
+			<< 100.0 * Threads.eval_cache_hits() / std::max(Threads.eval_cache_probes(), uint64_t(1))
+			<< "% of " << Threads.eval_cache_probes() << " probes)"
+			<< "\nMoves generated : " << Threads.moves_generated_per_node() << " per node" << endl;
+
+	if (stops)
+		cerr << "Stop latency    : " << latency / stops << " ms average, "
+			<< maxLatency << " ms max" << endl;
+
+#if defined(TT_STATS)
+	if (!limits.perft)
+		cerr << TT.stats() << endl;
+#endif
+}
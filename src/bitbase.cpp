@@ -1,3 +1,4 @@
+#include <mutex>
 #include <vector>
 #include <cassert>
 
@@ -12,6 +13,10 @@ namespace
 	// Each uint32_t stores results of 32 positions, one per bit
 	uint32_t KPKBitbase[MAX_INDEX / 32];
 
+	// The bitbase takes a few ms to build and most games never reach KPK, so
+	// it is built by the first probe instead of at startup.
+	std::once_flag KPKInit;
+
 	// A KPK bitbase index is an integer in [0, IndexMax] range
 	//
 	// Information is mapped in a way that minimizes the number of iterations:
@@ -59,6 +64,8 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color us)
 
 	assert(file_of(wpsq) <= FILE_D);
 
+	std::call_once(KPKInit, Bitbases::init);
+
 	unsigned idx = index(us, bksq, wksq, wpsq);
 	return KPKBitbase[idx / 32] & (1 << (idx & 0x1F));
 }
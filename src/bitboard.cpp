@@ -1,10 +1,14 @@
 #include <algorithm>
-#include <chrono>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <thread>
+#include <vector>
 #include <cassert>
 
 #include "bitboard.h"
+#include "misc.h"
 
 int SquareDistance[SQUARE_NB][SQUARE_NB];
 
@@ -20,6 +24,19 @@ Bitboard* HorseAttacks[SQUARE_NB];
 Bitboard  ElephantMasks[SQUARE_NB];
 Bitboard* ElephantAttacks[SQUARE_NB];
 
+uint64_t ChariotMagics[SQUARE_NB][2];
+uint64_t CanonMagics[SQUARE_NB][2];
+uint64_t HorseMagics[SQUARE_NB][2];
+uint64_t ElephantMagics[SQUARE_NB][2];
+unsigned ChariotShifts[SQUARE_NB];
+unsigned CanonShifts[SQUARE_NB];
+unsigned HorseShifts[SQUARE_NB];
+unsigned ElephantShifts[SQUARE_NB];
+bool UsePext;
+
+bool PextSliders;
+SliderLookup SliderAttacks[2];
+
 Bitboard SquareBB[SQUARE_NB];
 Bitboard FileBB[FILE_NB];
 Bitboard RankBB[RANK_NB];
@@ -36,15 +53,204 @@ Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
 
 namespace
 {
-	Bitboard ChariotTable[0x108000];	// To store chariot attacks
-	Bitboard CanonTable[0x108000/*0xB40000*/];		// To store canon attacks
-	Bitboard HorseTable[0x10F00];		// To store horse attacks
-	Bitboard ElephantTable[0xB24];		// To store elephant attacks
+	Bitboard ChariotTable[0x108000];	// To store chariot attacks, built on demand
+	Bitboard CanonTable[0x108000/*0xB40000*/];		// To store canon attacks, built on demand
+	Bitboard HorseTable[0x5A0];		// To store horse attacks
+	Bitboard ElephantTable[0x5A0];		// To store elephant attacks
+
+	// Magics for the chariot and canon tables, which would take minutes to find
+	// at startup as their masks have up to 15 bits. They are still checked when
+	// the tables are built and searched again if they do not fit.
+	const uint64_t ChariotMagicsInit[SQUARE_NB][2] = {
+		{ 0x4080012004070141ULL, 0x1080040000120008ULL }, { 0x0200800300140080ULL, 0x0400806200404008ULL },
+		{ 0x0240080000800040ULL, 0x400E60001210000CULL }, { 0x15000080840100C4ULL, 0x88814E041000002CULL },
+		{ 0x0080020000202006ULL, 0x4010094000021041ULL }, { 0x1600082081004008ULL, 0x442106802008C203ULL },
+		{ 0x4DC0088000080001ULL, 0x0841004600000004ULL }, { 0x0040004000C10101ULL, 0x0040800044000000ULL },
+		{ 0x80800004A4208206ULL, 0x2000044441040120ULL }, { 0x0002200114000081ULL, 0x0181280000020000ULL },
+		{ 0x0004040200004083ULL, 0x0684028000008000ULL }, { 0x0000801000420080ULL, 0x1200880110010000ULL },
+		{ 0x0010040015100010ULL, 0x4402000580000708ULL }, { 0x012800200440408CULL, 0x008408001202A910ULL },
+		{ 0x9000800012404004ULL, 0x1012180000010040ULL }, { 0x0002800049204014ULL, 0x080480800089040CULL },
+		{ 0x4000200004080001ULL, 0x108100200000000AULL }, { 0x1811002000102101ULL, 0xE01E004020100840ULL },
+		{ 0x0200041000820005ULL, 0x0000100004840510ULL }, { 0x081800B800009480ULL, 0x0108284108515000ULL },
+		{ 0x8000240200002085ULL, 0x2401240000008008ULL }, { 0x0040108800800010ULL, 0x0850040301000200ULL },
+		{ 0x8100014000401044ULL, 0x0008901106800000ULL }, { 0x0004005000400008ULL, 0x8008C08A00805002ULL },
+		{ 0x002F000400148406ULL, 0x0200100000280900ULL }, { 0x0001800800082001ULL, 0x0000211000B04018ULL },
+		{ 0x0000081000010102ULL, 0x0000088000000002ULL }, { 0x0400100208004081ULL, 0x62042C0000402012ULL },
+		{ 0x0620840002011100ULL, 0x9000040000445000ULL }, { 0x1000040010200080ULL, 0x2200800080400010ULL },
+		{ 0x4008010002010008ULL, 0x1430B50840020130ULL }, { 0x000400019000240AULL, 0x040A081550809020ULL },
+		{ 0x0000400400208801ULL, 0x4082200000000208ULL }, { 0x2090011010002108ULL, 0x0901800020204001ULL },
+		{ 0x8072104810100002ULL, 0x4003010200044404ULL }, { 0x0488001408000A42ULL, 0x0080001414011010ULL },
+		{ 0x00A0180001202001ULL, 0x2102008040412600ULL }, { 0x000400050A210040ULL, 0x8000092200281080ULL },
+		{ 0x0800880104100041ULL, 0x004C100000110880ULL }, { 0x8214000040008004ULL, 0x0810084032121203ULL },
+		{ 0x0040144400100014ULL, 0x4002042100382060ULL }, { 0x4200820200100094ULL, 0x8000810011042059ULL },
+		{ 0x2100002008040048ULL, 0x2005004202E40440ULL }, { 0x6020200004020002ULL, 0x0A00498804000000ULL },
+		{ 0x0400000441004001ULL, 0x0022040089000060ULL }, { 0x8A28090020080801ULL, 0x0A00200001410408ULL },
+		{ 0x4071100045400010ULL, 0x1001040400800008ULL }, { 0x5802000500010080ULL, 0x6003420001882128ULL },
+		{ 0x4006020020200040ULL, 0x4070010184804020ULL }, { 0x2000080104008002ULL, 0x1089000082002000ULL },
+		{ 0x0090080800A04001ULL, 0x2024080000000400ULL }, { 0x0002800041004008ULL, 0x8020208020882822ULL },
+		{ 0x0040220008121002ULL, 0x8204004000800800ULL }, { 0x00D1208002000802ULL, 0x6080004104002804ULL },
+		{ 0x0060000B01060081ULL, 0x0220400068004012ULL }, { 0x0008041510040084ULL, 0x0041080044000218ULL },
+		{ 0x0408080008008001ULL, 0x21880E8E0002A100ULL }, { 0x0280040000483601ULL, 0x8418201114000000ULL },
+		{ 0x2842004100041201ULL, 0x0001220000000942ULL }, { 0x0150002020001044ULL, 0x0004040004800240ULL },
+		{ 0x00040924C0444104ULL, 0x2200220416011841ULL }, { 0x0020000808084488ULL, 0x004102001008C500ULL },
+		{ 0x2208400240040084ULL, 0x02002141005029C0ULL }, { 0x0028000820241081ULL, 0x0080200000010202ULL },
+		{ 0xA210000208146009ULL, 0xD0080121820A8020ULL }, { 0x24A4100600005010ULL, 0x0020100000040140ULL },
+		{ 0x4180220802029414ULL, 0x02000A0400000602ULL }, { 0x100001030104007CULL, 0x0080010880883080ULL },
+		{ 0x2000142002802008ULL, 0x0404000080040010ULL }, { 0x000B004004288201ULL, 0x00100820000004E0ULL },
+		{ 0x0004100420004845ULL, 0x4804020000047004ULL }, { 0x00010804A8002502ULL, 0x004000040A04C08DULL },
+		{ 0x00685A0002018201ULL, 0x0170100040800040ULL }, { 0x4100C80500108100ULL, 0x8040200000044100ULL },
+		{ 0x0100100082008280ULL, 0x0018100001080448ULL }, { 0x0446600100489160ULL, 0x2000200000004548ULL },
+		{ 0x40800802800C0120ULL, 0x200810410000C890ULL }, { 0x0180805080089010ULL, 0x1540080800401800ULL },
+		{ 0x0400C0400020C608ULL, 0x0490400500320000ULL }, { 0x000000103012E004ULL, 0x8002040000000004ULL },
+		{ 0x0040A20004008082ULL, 0x800040008009000CULL }, { 0x0890440200404021ULL, 0x1040000200809000ULL },
+		{ 0x1000010040108401ULL, 0x0048440040704000ULL }, { 0x0080008400004D40ULL, 0xA004100804040000ULL },
+		{ 0x100860010000A008ULL, 0x0280010100008096ULL }, { 0x2288A10440120020ULL, 0x1000800220000004ULL },
+		{ 0x0082000320002682ULL, 0x4400004020100002ULL }, { 0x9000084084E08002ULL, 0x0400402020404000ULL },
+		{ 0x0028010040010204ULL, 0x2003304000000041ULL }, { 0x08C4003004004002ULL, 0x84000A0200090000ULL },
+	};
+
+	const uint64_t CanonMagicsInit[SQUARE_NB][2] = {
+		{ 0x4080012004070141ULL, 0x1080040000120008ULL }, { 0x0200800300140080ULL, 0x0400806200404008ULL },
+		{ 0x0240080000800040ULL, 0x400E60001210000CULL }, { 0x15000080840100C4ULL, 0x88814E041000002CULL },
+		{ 0x0080020000202006ULL, 0x4010094000021041ULL }, { 0x1600082081004008ULL, 0x442106802008C203ULL },
+		{ 0x4DC0088000080001ULL, 0x0841004600000004ULL }, { 0x0040004000C10101ULL, 0x0040800044000000ULL },
+		{ 0x80800004A4208206ULL, 0x2000044441040120ULL }, { 0x0002200114000081ULL, 0x0181280000020000ULL },
+		{ 0x0004040200004083ULL, 0x0684028000008000ULL }, { 0x0000801000420080ULL, 0x1200880110010000ULL },
+		{ 0x0010040015100010ULL, 0x4402000580000708ULL }, { 0x012800200440408CULL, 0x008408001202A910ULL },
+		{ 0x9000800012404004ULL, 0x1012180000010040ULL }, { 0x0002800049204014ULL, 0x080480800089040CULL },
+		{ 0x4000200004080001ULL, 0x108100200000000AULL }, { 0x1811002000102101ULL, 0xE01E004020100840ULL },
+		{ 0x0200041000820005ULL, 0x0000100004840510ULL }, { 0x081800B800009480ULL, 0x0108284108515000ULL },
+		{ 0x8000240200002085ULL, 0x2401240000008008ULL }, { 0x0040108800800010ULL, 0x0850040301000200ULL },
+		{ 0x8100014000401044ULL, 0x0008901106800000ULL }, { 0x0004005000400008ULL, 0x8008C08A00805002ULL },
+		{ 0x002F000400148406ULL, 0x0200100000280900ULL }, { 0x0001800800082001ULL, 0x0000211000B04018ULL },
+		{ 0x0000081000010102ULL, 0x0000088000000002ULL }, { 0x0400100208004081ULL, 0x62042C0000402012ULL },
+		{ 0x0620840002011100ULL, 0x9000040000445000ULL }, { 0x1000040010200080ULL, 0x2200800080400010ULL },
+		{ 0x4008010002010008ULL, 0x1430B50840020130ULL }, { 0x000400019000240AULL, 0x040A081550809020ULL },
+		{ 0x0000400400208801ULL, 0x4082200000000208ULL }, { 0x2090011010002108ULL, 0x0901800020204001ULL },
+		{ 0x8072104810100002ULL, 0x4003010200044404ULL }, { 0x0488001408000A42ULL, 0x0080001414011010ULL },
+		{ 0x00A0180001202001ULL, 0x2102008040412600ULL }, { 0x000400050A210040ULL, 0x8000092200281080ULL },
+		{ 0x0800880104100041ULL, 0x004C100000110880ULL }, { 0x8214000040008004ULL, 0x0810084032121203ULL },
+		{ 0x0040144400100014ULL, 0x4002042100382060ULL }, { 0x4200820200100094ULL, 0x8000810011042059ULL },
+		{ 0x2100002008040048ULL, 0x2005004202E40440ULL }, { 0x6020200004020002ULL, 0x0A00498804000000ULL },
+		{ 0x0400000441004001ULL, 0x0022040089000060ULL }, { 0x8A28090020080801ULL, 0x0A00200001410408ULL },
+		{ 0x4071100045400010ULL, 0x1001040400800008ULL }, { 0x5802000500010080ULL, 0x6003420001882128ULL },
+		{ 0x4006020020200040ULL, 0x4070010184804020ULL }, { 0x2000080104008002ULL, 0x1089000082002000ULL },
+		{ 0x0090080800A04001ULL, 0x2024080000000400ULL }, { 0x0002800041004008ULL, 0x8020208020882822ULL },
+		{ 0x0040220008121002ULL, 0x8204004000800800ULL }, { 0x00D1208002000802ULL, 0x6080004104002804ULL },
+		{ 0x0060000B01060081ULL, 0x0220400068004012ULL }, { 0x0008041510040084ULL, 0x0041080044000218ULL },
+		{ 0x0408080008008001ULL, 0x21880E8E0002A100ULL }, { 0x0280040000483601ULL, 0x8418201114000000ULL },
+		{ 0x2842004100041201ULL, 0x0001220000000942ULL }, { 0x0150002020001044ULL, 0x0004040004800240ULL },
+		{ 0x00040924C0444104ULL, 0x2200220416011841ULL }, { 0x0020000808084488ULL, 0x004102001008C500ULL },
+		{ 0x2208400240040084ULL, 0x02002141005029C0ULL }, { 0x0028000820241081ULL, 0x0080200000010202ULL },
+		{ 0xA210000208146009ULL, 0xD0080121820A8020ULL }, { 0x24A4100600005010ULL, 0x0020100000040140ULL },
+		{ 0x4180220802029414ULL, 0x02000A0400000602ULL }, { 0x100001030104007CULL, 0x0080010880883080ULL },
+		{ 0x2000142002802008ULL, 0x0404000080040010ULL }, { 0x000B004004288201ULL, 0x00100820000004E0ULL },
+		{ 0x0004100420004845ULL, 0x4804020000047004ULL }, { 0x00010804A8002502ULL, 0x004000040A04C08DULL },
+		{ 0x00685A0002018201ULL, 0x0170100040800040ULL }, { 0x4100C80500108100ULL, 0x8040200000044100ULL },
+		{ 0x0100100082008280ULL, 0x0018100001080448ULL }, { 0x0446600100489160ULL, 0x2000200000004548ULL },
+		{ 0x40800802800C0120ULL, 0x200810410000C890ULL }, { 0x0180805080089010ULL, 0x1540080800401800ULL },
+		{ 0x0400C0400020C608ULL, 0x0490400500320000ULL }, { 0x4080202004040004ULL, 0x1300400400300421ULL },
+		{ 0x0040A20004008082ULL, 0x800040008009000CULL }, { 0x0890440200404021ULL, 0x1040000200809000ULL },
+		{ 0x1000010040108401ULL, 0x0048440040704000ULL }, { 0x100010A804002060ULL, 0x4001050200000040ULL },
+		{ 0x100860010000A008ULL, 0x0280010100008096ULL }, { 0x2288A10440120020ULL, 0x1000800220000004ULL },
+		{ 0x0082000320002682ULL, 0x4400004020100002ULL }, { 0x9000084084E08002ULL, 0x0400402020404000ULL },
+		{ 0x0028010040010204ULL, 0x2003304000000041ULL }, { 0x08C4003004004002ULL, 0x84000A0200090000ULL },
+	};
+
+	Square OrthogonalDeltas[] = { NORTH,  EAST,  SOUTH,  WEST };
+	bool PextSlidersInit;
 
 	template <PieceType Pt>
-	void init_magics(Bitboard table[], Bitboard* attacks[],	Bitboard masks[], Square deltas[], int deltasSize);
+	void init_magics(Bitboard table[], Bitboard* attacks[],	Bitboard masks[], uint64_t magics[][2],
+					 unsigned shifts[], Square deltas[], int deltasSize, const uint64_t known[][2] = nullptr);
+
+	/// pext_si128() gathers the bits of src selected by mask into a contiguous
+	/// index, the lower lane bits first.
+	TARGET_BMI2 inline unsigned pext_si128(Bitboard src, Bitboard mask)
+	{
+		uint64_t low = pext(src.lower(), mask.lower());
+		uint64_t high = pext(src.upper(), mask.upper());
+
+		return unsigned(((high << popcount64(mask.lower())) | low) & 0xFFFFFFFF);
+	}
+
+	/// pext_attacks() and magic_attacks() are the two chariot and canon lookups
+	/// in the per square tables that SliderAttacks can point to. The former is
+	/// compiled for BMI2 as a whole, so that pext is inlined into it.
+	template<PieceType Pt>
+	TARGET_BMI2 Bitboard pext_attacks(Square s, Bitboard occupied)
+	{
+		return Pt == CHARIOT ? ChariotAttacks[s][pext_si128(occupied, ChariotMasks[s])]
+							 : CanonAttacks[s][pext_si128(occupied, CanonMasks[s])];
+	}
+
+	template<PieceType Pt>
+	Bitboard magic_attacks(Square s, Bitboard occupied)
+	{
+		return table_attacks<Pt>(s, occupied);
+	}
+}
+
+namespace
+{
+	/// line_attack() returns the chariot or canon attacks from point 'from' of a
+	/// line of 'len' points, 'occupied' holding one bit per point. A canon
+	/// attacks the empty points past its screen and the first piece behind it.
+
+	constexpr unsigned line_attack(int from, int len, unsigned occupied, bool canon)
+	{
+		unsigned attack = 0;
+
+		for (int dir = -1; dir <= 1; dir += 2)
+		{
+			bool pastScreen = !canon;
+
+			for (int i = from + dir; i >= 0 && i < len; i += dir)
+			{
+				bool blocked = occupied & (1U << i);
+
+				if (!pastScreen)
+				{
+					pastScreen = blocked;
+					continue;
+				}
+
+				attack |= 1U << i;
+
+				if (blocked)
+					break;
+			}
+		}
+
+		return attack;
+	}
+
+	/// make_line_tables() solves every rank and file for chariots and canons.
+	/// The index holds the inner points of the line, board edges never change
+	/// the result. Ranks are stored as seen from rank 1 and files from file A,
+	/// line_attacks() shifts them into place.
+
+	constexpr LineTables make_line_tables()
+	{
+		LineTables lt = {};
+
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int f = 0; f < FILE_NB; ++f)
+				for (unsigned idx = 0; idx < 128; ++idx)
+					lt.rank[t][f][idx] = uint16_t(line_attack(f, FILE_NB, idx << 1, t));
+
+			for (int r = 0; r < RANK_NB; ++r)
+				for (unsigned idx = 0; idx < 256; ++idx)
+					lt.file[t][r][idx] = uint16_t(line_attack(r, RANK_NB, idx << 1, t));
+		}
+
+		return lt;
+	}
 }
 
+extern const LineTables LineAttacks = make_line_tables();
+
 const std::string Bitboards::pretty(Bitboard b)
 {
 	std::string s = "";
@@ -130,8 +336,6 @@ void Bitboards::init()
 					}
 				}
 
-	Square ChariotDeltas[]	= { NORTH,  EAST,  SOUTH,  WEST };
-	Square CanonDeltas[]	= { NORTH,  EAST,  SOUTH,  WEST };
 	Square HorseDeltas[]	= {	NORTH + NORTH + EAST, NORTH + NORTH + WEST,
 								SOUTH + SOUTH + EAST, SOUTH + SOUTH + WEST,
 								EAST + EAST + NORTH, EAST + EAST + SOUTH,
@@ -139,37 +343,14 @@ void Bitboards::init()
 								NORTH,  EAST,  SOUTH,  WEST };
 	Square ElephantDeltas[] = {  NORTH_EAST + NORTH_EAST, NORTH_WEST + NORTH_WEST,
 								SOUTH_EAST + SOUTH_EAST, SOUTH_WEST + SOUTH_WEST,
-								NORTH_EAST,  NORTH_WEST, SOUTH_WEST,  SOUTH_WEST };
-#if _DEBUG
-	std::chrono::time_point<std::chrono::system_clock> startt, endt;
-	std::chrono::duration<double> elapsed;
-
-#	define STARTT	\
-	startt = std::chrono::system_clock::now();
-#	define ENDT	\
-	endt = std::chrono::system_clock::now(); \
-	elapsed = endt - startt; \
-	std::cout << "initialize the attack table: " << elapsed.count() << "(s)" << std::endl;
-#else
-#	define STARTT
-#	define ENDT
-#endif
-
-	STARTT
-	init_magics<CHARIOT>(ChariotTable, ChariotAttacks, ChariotMasks, ChariotDeltas, 4);
-	ENDT
-
-	STARTT
-	init_magics<CANON>(CanonTable, CanonAttacks, CanonMasks, CanonDeltas, 4);
-	ENDT
-
-	STARTT
-	init_magics<HORSE>(HorseTable, HorseAttacks, HorseMasks, HorseDeltas, 12);
-	ENDT
-
-	STARTT
-	init_magics<ELEPHANT>(ElephantTable, ElephantAttacks, ElephantMasks, ElephantDeltas, 8);
-	ENDT
+								NORTH_EAST,  NORTH_WEST, SOUTH_EAST,  SOUTH_WEST };
+
+	UsePext = cpu_has_fast_pext();
+	SliderAttacks[0] = UsePext ? pext_attacks<CHARIOT> : magic_attacks<CHARIOT>;
+	SliderAttacks[1] = UsePext ? pext_attacks<CANON> : magic_attacks<CANON>;
+
+	init_magics<HORSE>(HorseTable, HorseAttacks, HorseMasks, HorseMagics, HorseShifts, HorseDeltas, 12);
+	init_magics<ELEPHANT>(ElephantTable, ElephantAttacks, ElephantMasks, ElephantMagics, ElephantShifts, ElephantDeltas, 8);
 
 	Bitboard surroundingBB;
 	for (Square s1 = PT_A1; s1 <= PT_I10; ++s1)
@@ -197,6 +378,162 @@ void Bitboards::init()
 	}
 }
 
+/// Bitboards::index_backend() names how chariot and canon attacks are looked
+/// up: in the rank and file tables, or in the per square tables indexed with
+/// pext or magics. Horses and elephants always use magics. The banner asks
+/// before Bitboards::init(), when the rank and file tables are the default.
+
+const char* Bitboards::index_backend()
+{
+	return !PextSliders ? "LINE" : UsePext ? "PEXT" : "MAGIC";
+}
+
+/// Bitboards::use_pext_sliders() switches chariot and canon lookups between
+/// the rank and file tables and the large per square tables, indexed with pext
+/// or magics. The latter take about 34 MB and are only computed the first time
+/// they are selected.
+
+void Bitboards::use_pext_sliders(bool enable)
+{
+	if (enable && !PextSlidersInit)
+	{
+		init_magics<CHARIOT>(ChariotTable, ChariotAttacks, ChariotMasks, ChariotMagics, ChariotShifts, OrthogonalDeltas, 4, ChariotMagicsInit);
+		init_magics<CANON>(CanonTable, CanonAttacks, CanonMasks, CanonMagics, CanonShifts, OrthogonalDeltas, 4, CanonMagicsInit);
+		PextSlidersInit = true;
+	}
+
+	PextSliders = enable;
+}
+
+/// Bitboards::bench() is a micro-benchmark of the Bitboard primitives of the
+/// backend selected at compile time. It reports ns/op for each of them, so that
+/// binaries built with different BB_* macros can be compared on the same CPU.
+/// It then times chariot and canon lookups through both the line tables and
+/// the per square tables, for random points and occupancies. The optional arguments
+/// are the number of operations per primitive and the number of threads that
+/// stream through 32 MB each meanwhile, standing in for other engine processes
+/// sharing the caches; keep it below the number of cores.
+
+void Bitboards::bench(std::istream& is)
+{
+	const int BoardsNb = 1024;
+	const Bitboard BoardMask = ~Bitboard(0) >> (128 - SQUARE_NB);
+
+	int64_t ops = 20000000;
+	int load = 0;
+	is >> ops >> load;
+
+	PRNG rng(1070372);
+	std::vector<Bitboard> boards(BoardsNb);
+	std::vector<Square> squares(BoardsNb);
+
+	for (Bitboard& b : boards)
+		while (!(b = Bitboard(rng.rand<uint64_t>(), rng.rand<uint64_t>()) & BoardMask)) {}
+
+	for (Square& s : squares)
+		s = Square(rng.rand<unsigned>() % SQUARE_NB);
+
+	uint64_t sink = 0;
+	int64_t n;
+
+	auto report = [&](const char* name, int64_t cnt, TimePoint elapsed) {
+		std::cout << std::setw(14) << std::left << name
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(8) << std::right << double(elapsed) * 1e6 / std::max(cnt, int64_t(1))
+			<< " ns/op" << std::endl;
+	};
+
+	std::cout << "Bitboard backend: " << BB_BACKEND
+			  << ", slider lookups: " << index_backend() << std::endl;
+
+	TimePoint t = now();
+	Bitboard acc;
+	for (n = 0; n < ops; ++n)
+		acc ^= boards[n & (BoardsNb - 1)] << int(n % SQUARE_NB);
+	sink += popcount(acc);
+	report("operator<<", ops, now() - t);
+
+	t = now();
+	for (n = 0; n < ops; ++n)
+		acc ^= boards[n & (BoardsNb - 1)] >> int(n % SQUARE_NB);
+	sink += popcount(acc);
+	report("operator>>", ops, now() - t);
+
+	t = now();
+	for (n = 0; n < ops; ++n)
+		acc = boards[n & (BoardsNb - 1)] - (acc & BoardMask);
+	sink += popcount(acc);
+	report("operator-", ops, now() - t);
+
+	t = now();
+	for (n = 0; n < ops; ++n)
+		sink += popcount(boards[n & (BoardsNb - 1)]);
+	report("popcount", ops, now() - t);
+
+	t = now();
+	for (n = 0; n < ops; ++n)
+		sink += lsb(boards[n & (BoardsNb - 1)]);
+	report("lsb", ops, now() - t);
+
+	t = now();
+	for (n = 0; n < ops; ++n)
+		sink += msb(boards[n & (BoardsNb - 1)]);
+	report("msb", ops, now() - t);
+
+	int64_t pops = 0;
+	t = now();
+	for (n = 0; pops < ops; ++n)
+		for (Bitboard b = boards[n & (BoardsNb - 1)]; b; ++pops)
+			sink += pop_lsb(&b);
+	report("pop_lsb", pops, now() - t);
+
+	int64_t visits = 0;
+	t = now();
+	for (n = 0; visits < ops; ++n)
+		for (Square s : boards[n & (BoardsNb - 1)])
+			sink += s, ++visits;
+	report("range-for", visits, now() - t);
+
+	bool pextSliders = PextSliders;
+	use_pext_sliders(true);
+
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> loaders;
+
+	for (int i = 0; i < load; ++i)
+		loaders.emplace_back([&stop] {
+			std::vector<uint64_t> buf(4 * 1024 * 1024);
+			for (uint64_t x = 0; !stop; ++x)
+				for (size_t j = 0; j < buf.size(); j += 8)
+					buf[j] += x;
+		});
+
+	std::cout << "Slider lookups, " << load << " load threads, table index: "
+			  << index_backend() << std::endl;
+
+	auto lookup = [&](const char* name, Bitboard (*attacks)(Square, Bitboard)) {
+		Bitboard a;
+		TimePoint t = now();
+		for (int64_t i = 0; i < ops; ++i)
+			a ^= attacks(squares[(i >> 10) & (BoardsNb - 1)], boards[i & (BoardsNb - 1)]);
+		report(name, ops, now() - t);
+		sink += popcount(a);
+	};
+
+	lookup("chariot line", line_attacks<CHARIOT>);
+	lookup("chariot table", SliderAttacks[0]);
+	lookup("canon line", line_attacks<CANON>);
+	lookup("canon table", SliderAttacks[1]);
+
+	stop = true;
+	for (std::thread& th : loaders)
+		th.join();
+
+	use_pext_sliders(pextSliders);
+
+	std::cout << "Checksum: " << sink << std::endl;
+}
+
 namespace
 {
 	Bitboard sliding_attack(Square deltas[], int deltasSize, Square sq, Bitboard occupied, PieceType pt = NO_PIECE_TYPE)
@@ -259,10 +596,8 @@ namespace
 			else if (dir == EAST + EAST + NORTH || dir == EAST + EAST + SOUTH) dir2 = EAST;
 			else if (dir == WEST + WEST + NORTH || dir == WEST + WEST + SOUTH) dir2 = WEST;
 
-			if ((file_of(sq) <= FILE_B && dir2 == WEST) || (file_of(sq) >= FILE_I && dir2 == EAST))
-				continue;
-
-			if (is_ok(s))
+			// Skip the steps which wrap around the board edges
+			if (is_ok(s) && distance<File>(sq, s) <= 2)
 			{
 				if (pt == HORSE)
 				{
@@ -296,8 +631,6 @@ namespace
 								Square dir2 = deltas[i] / 2;
 								if (occupied & (sq + dir2))
 									continue;
-								if (occupied & (sq + dir))
-									continue;
 
 								attack |= s;
 							}
@@ -314,12 +647,22 @@ namespace
 		return attack;
 	}
 
-	/// init_magics() computes all chariot and canon attacks at startup.
+	/// init_magics() computes all attacks of a piece type at startup. Chariot and
+	/// canon tables are indexed with pext when the CPU has a fast one, otherwise
+	/// we look for a pair of magics per point, as in Stockfish for 64 bit boards, that maps
+	/// every subset of the mask to its own entry or to one with the same attacks.
 
 	template <PieceType Pt>
-	void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard masks[], Square deltas[], int deltasSize)
+	void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard masks[], uint64_t magics[][2],
+					 unsigned shifts[], Square deltas[], int deltasSize, const uint64_t known[][2])
 	{
-		Bitboard edges, b, ring;
+		const int MaxSize = 1 << 15;
+
+		static Bitboard occupancy[MaxSize], reference[MaxSize];
+		static int epoch[MaxSize];
+		int cnt = 0;
+
+		Bitboard edges, b;
 		int size;
 		auto attack = (Pt == CANON || Pt == CHARIOT) ? sliding_attack : step_attack;
 
@@ -335,11 +678,12 @@ namespace
 			// 's' computed on an empty board. The index must be big enough to contain
 			// all the attacks for each possible subset of the mask and so is 2 power
 			// the number of 1s of the mask. Hence we deduce the size of the shift to
-			// apply to the 64 or 32 bits word to get the index.
-			if (Pt == CANON)
-				masks[s] = attack(deltas, deltasSize, s, 0, NO_PIECE_TYPE) & ~edges;
-			else
-				masks[s] = attack(deltas, deltasSize, s, 0, NO_PIECE_TYPE) & ~edges;
+			// apply to the 64 bits product to get the index.
+			// Horses and elephants are only blocked on the squares next to them,
+			// which are the last four of their deltas.
+			masks[s] = Pt == HORSE || Pt == ELEPHANT ? step_attack(deltas + deltasSize - 4, 4, s, 0) & ~edges
+													 : attack(deltas, deltasSize, s, 0, NO_PIECE_TYPE) & ~edges;
+			shifts[s] = 64 - popcount(masks[s]);
 
 			// Use Carry-Rippler trick to enumerate all subsets of masks[s] and
 			// store the corresponding sliding attack bitboard in reference[].
@@ -347,14 +691,49 @@ namespace
 
 			do
 			{
-				attacks[s][pext_si128(b.v, masks[s].v)] = attack(deltas, deltasSize, s, b, Pt);
+				occupancy[size] = b;
+				reference[size] = attack(deltas, deltasSize, s, b, Pt);
+
+				if (UsePext && (Pt == CHARIOT || Pt == CANON))
+					attacks[s][pext_si128(b, masks[s])] = reference[size];
+
 				size++;
 				b = (b - masks[s]) & masks[s];
 			} while (b);
 
+			assert(size <= MaxSize);
+
 			// Set the offset for the table of the next point.
 			if (s < PT_I10)
-				attacks[s + 1] = attacks[s] + size;      
-		}    
+				attacks[s + 1] = attacks[s] + size;
+
+			if (UsePext && (Pt == CHARIOT || Pt == CANON))
+				continue;
+
+			PRNG rng(1070372 + 31 * s);
+
+			// Find magics with a trial and error loop, the first try being the
+			// known ones if any. An entry of attacks[s] is valid for the current
+			// try only if its epoch matches 'cnt', which saves clearing the table
+			// between tries.
+			for (int i = 0, tries = 0; i < size; ++tries)
+			{
+				magics[s][0] = known && !tries ? known[s][0] : rng.sparse_rand<uint64_t>();
+				magics[s][1] = known && !tries ? known[s][1] : rng.sparse_rand<uint64_t>();
+
+				for (++cnt, i = 0; i < size; ++i)
+				{
+					unsigned idx = magic_index<Pt>(s, occupancy[i]);
+
+					if (epoch[idx] < cnt)
+					{
+						epoch[idx] = cnt;
+						attacks[s][idx] = reference[i];
+					}
+					else if (attacks[s][idx] != reference[i])
+						break;
+				}
+			}
+		}
 	}
 }
@@ -1,6 +1,7 @@
 #ifndef __BITBOARD_H__
 #define __BITBOARD_H__
 
+#include <istream>
 #include <string>
 #include <stdio.h>
 
@@ -16,6 +17,9 @@ class Bitboard;
 namespace Bitboards
 {
 	void init();
+	void use_pext_sliders(bool enable);
+	const char* index_backend();
+	void bench(std::istream& is);
 	const std::string pretty(Bitboard b);
 }
 
@@ -24,119 +28,176 @@ class Bitboard
 public:
 	Bitboard()
 	{
-		v = _mm_setzero_si128();
+		reset();
 	}
 
-	Bitboard(__m128i v)
+	Bitboard(pair64 c)
 	{
-		this->v = v;
+		set(c.lower, c.upper);
 	}
 
-	Bitboard(pair64 c)
+	Bitboard(uint64_t n)
 	{
-		v.m128i_i64[0] = c.lower;
-		v.m128i_i64[1] = c.upper;
+		set(n, 0);
 	}
 
-	Bitboard(uint64_t n)
+	Bitboard(uint64_t lower, uint64_t upper)
 	{
-		v.m128i_i64[0] = n;
-		v.m128i_i64[1] = 0;
+		set(lower, upper);
 	}
 
-	Bitboard(const Bitboard& b)
+#if defined(BB_SSE2)
+	Bitboard(__m128i v)
 	{
-		v = b.v;
+		this->v = v;
 	}
 
-  Bitboard& operator=(const __m128i& m)
+	operator __m128i() const
+	{
+		return v;
+	}
+#elif defined(BB_INT128)
+	static Bitboard from_u128(unsigned __int128 v)
 	{
-		v = m;
+		Bitboard b;
+		b.v = v;
+		return b;
 	}
+#endif
 
 	Bitboard& operator=(const pair64& c)
 	{
-		v.m128i_i64[0] = c.lower;
-		v.m128i_i64[1] = c.upper;
+		set(c.lower, c.upper);
 		return *this;
 	}
 
 	Bitboard& operator=(const uint64_t& n)
 	{
-		v.m128i_i64[0] = n;
-		v.m128i_i64[1] = 0;
+		set(n, 0);
 		return *this;
 	}
 
-	Bitboard& operator=(const Bitboard& b)
+	explicit operator bool() const
 	{
-		v = b.v;
-		return *this;
+#if defined(BB_SSE2)
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF;
+#elif defined(BB_INT128)
+		return v != 0;
+#else
+		return (v[0] | v[1]) != 0;
+#endif
 	}
 
-	operator const bool() const
+	operator pair64() const
 	{
-		return v.m128i_i64[0] | v.m128i_i64[1];
+		return pair64(lower(), upper());
 	}
 
-	operator pair64()
+	/// lower() and upper() return the 64 bit halves holding points 0..63 and
+	/// 64..127 respectively.
+	uint64_t lower() const
 	{
-		pair64 p;
-		p.lower = v.m128i_i64[0];
-		p.upper = v.m128i_i64[1];
-		return p;
+#if defined(BB_SSE2)
+		return (uint64_t)_mm_cvtsi128_si64(v);
+#elif defined(BB_INT128)
+		return (uint64_t)v;
+#else
+		return v[0];
+#endif
 	}
 
-	operator __m128i()
+	uint64_t upper() const
 	{
-		return v;
+#if defined(BB_SSE2)
+		return (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v));
+#elif defined(BB_INT128)
+		return (uint64_t)(v >> 64);
+#else
+		return v[1];
+#endif
+	}
+
+	void set(uint64_t lower, uint64_t upper)
+	{
+#if defined(BB_SSE2)
+		v = _mm_set_epi64x((long long)upper, (long long)lower);
+#elif defined(BB_INT128)
+		v = ((unsigned __int128)upper << 64) | lower;
+#else
+		v[0] = lower;
+		v[1] = upper;
+#endif
 	}
 
 	void reset()
 	{
-		v = _mm_setzero_si128();
+		set(0, 0);
 	}
 
-	std::string str()
+	std::string str() const
 	{
 		char str[64];
 
-		sprintf_s(str, "0x%llx-0x%llx", v.m128i_u64[0], v.m128i_u64[1]);
-		return std::string(std::move(str));
+		snprintf(str, sizeof(str), "0x%llx-0x%llx", (unsigned long long)lower(), (unsigned long long)upper());
+		return std::string(str);
 	}
 public:
+#if defined(BB_SSE2)
 	__m128i v;
+#elif defined(BB_INT128)
+	unsigned __int128 v;
+#else
+	uint64_t v[2];
+#endif
 };
 
-inline Bitboard operator << (Bitboard b, int n)
+#if defined(BB_SSE2)
+
+/// SSE2 has no 128 bit shift by bits, so we combine the 64 bit lane shifts with
+/// the byte shifts moving one lane into the other.
+inline __m128i shl_si128(__m128i v, int n)
 {
-	__m128i tmp = b.v;
-	MM_SHL_SI128(tmp, n);
-	return tmp;
+	if (n >> 6)
+		return _mm_slli_epi64(_mm_slli_si128(v, 8), n - 64);
+
+	return _mm_or_si128(_mm_slli_epi64(v, n), _mm_srli_epi64(_mm_slli_si128(v, 8), 64 - n));
 }
 
-inline Bitboard operator >> (Bitboard b, int n)
+inline __m128i shr_si128(__m128i v, int n)
 {
-	__m128i tmp = b.v;
-	MM_SHR_SI128(tmp, n);
-	return tmp;
+	if (n >> 6)
+		return _mm_srli_epi64(_mm_srli_si128(v, 8), n - 64);
+
+	return _mm_or_si128(_mm_srli_epi64(v, n), _mm_slli_epi64(_mm_srli_si128(v, 8), 64 - n));
 }
 
-const Bitboard one_epi64 = pair64(1, 1);
-const Bitboard one_si128 = 1;
-const Bitboard carryone_si128 = pair64(0, 1);
-const Bitboard setone_si128 = pair64(0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL);
+#endif
 
-inline bool overflow_l_epi64(__m128i a, __m128i b)
+inline Bitboard operator << (Bitboard b, int n)
 {
-	__m128i x, y;
-	x = _mm_or_si128(a, b);
-	x = _mm_xor_si128(x, setone_si128.v);
-	y = _mm_and_si128(a, b);
-
-	return (x.m128i_u64[0] == 0ULL && y.m128i_u64[0] > 0ULL) || (x.m128i_u64[0] != 0ULL && x.m128i_u64[0] < y.m128i_u64[0]);
+#if defined(BB_SSE2)
+	return shl_si128(b.v, n);
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(b.v << n);
+#else
+	return  n >= 64 ? Bitboard(0, b.v[0] << (n - 64))
+		  : n == 0  ? b
+		  : Bitboard(b.v[0] << n, (b.v[1] << n) | (b.v[0] >> (64 - n)));
+#endif
 }
 
+inline Bitboard operator >> (Bitboard b, int n)
+{
+#if defined(BB_SSE2)
+	return shr_si128(b.v, n);
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(b.v >> n);
+#else
+	return  n >= 64 ? Bitboard(b.v[1] >> (n - 64), 0)
+		  : n == 0  ? b
+		  : Bitboard((b.v[0] >> n) | (b.v[1] << (64 - n)), b.v[1] >> n);
+#endif
+}
 
 const Bitboard FileABB = pair64(0x8040201008040201ULL, 0x20100ULL);
 const Bitboard FileBBB = FileABB << 1;
@@ -176,98 +237,119 @@ extern Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
 extern Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
 
 /// bitwise and
-inline Bitboard operator&(Bitboard b, Square s)
-{
-	return _mm_and_si128(b.v, SquareBB[s].v);
-}
-
 inline Bitboard operator&(Bitboard b, Bitboard d)
 {
+#if defined(BB_SSE2)
 	return _mm_and_si128(b.v, d.v);
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(b.v & d.v);
+#else
+	return Bitboard(b.v[0] & d.v[0], b.v[1] & d.v[1]);
+#endif
 }
 
-/// bitwise or
-inline Bitboard operator|(Bitboard b, Square s)
+inline Bitboard operator&(Bitboard b, Square s)
 {
-	return _mm_or_si128(b.v, SquareBB[s].v);
+	return b & SquareBB[s];
 }
 
+/// bitwise or
 inline Bitboard operator|(Bitboard b, Bitboard d)
 {
+#if defined(BB_SSE2)
 	return _mm_or_si128(b.v, d.v);
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(b.v | d.v);
+#else
+	return Bitboard(b.v[0] | d.v[0], b.v[1] | d.v[1]);
+#endif
 }
 
-/// bitwise xor
-inline Bitboard operator^(Bitboard b, Square s)
+inline Bitboard operator|(Bitboard b, Square s)
 {
-	return _mm_xor_si128(b.v, SquareBB[s].v);
+	return b | SquareBB[s];
 }
 
+/// bitwise xor
 inline Bitboard operator^(Bitboard b, Bitboard d)
 {
+#if defined(BB_SSE2)
 	return _mm_xor_si128(b.v, d.v);
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(b.v ^ d.v);
+#else
+	return Bitboard(b.v[0] ^ d.v[0], b.v[1] ^ d.v[1]);
+#endif
+}
+
+inline Bitboard operator^(Bitboard b, Square s)
+{
+	return b ^ SquareBB[s];
 }
 
 /// bitwise not
 inline Bitboard operator~(Bitboard b)
 {
-	return _mm_xor_si128(b.v, setone_si128.v);
+#if defined(BB_SSE2)
+	return _mm_xor_si128(b.v, _mm_cmpeq_epi32(b.v, b.v));
+#elif defined(BB_INT128)
+	return Bitboard::from_u128(~b.v);
+#else
+	return Bitboard(~b.v[0], ~b.v[1]);
+#endif
 }
 
 inline Bitboard& operator&=(Bitboard& b, Square s)
 {
-	b.v = _mm_and_si128(b.v, SquareBB[s].v);
-	return b;
+	return b = b & s;
 }
 
 inline Bitboard& operator&=(Bitboard& b, Bitboard d)
 {
-	b.v = _mm_and_si128(b.v, d.v);
-	return b;
+	return b = b & d;
 }
 
 inline Bitboard& operator|=(Bitboard& b, Square s)
 {
-	b.v = _mm_or_si128(b.v, SquareBB[s].v);
-	return b;
+	return b = b | s;
 }
 
 inline Bitboard& operator|=(Bitboard& b, Bitboard d)
 {
-	b.v = _mm_or_si128(b.v, d.v);
-	return b;
+	return b = b | d;
 }
 
 inline Bitboard& operator^=(Bitboard& b, Square s)
 {
-	b.v = _mm_xor_si128(b.v, SquareBB[s].v);
-	return b;
+	return b = b ^ s;
 }
 
 inline Bitboard& operator^=(Bitboard& b, Bitboard d)
 {
-	b.v = _mm_xor_si128(b.v, d.v);
-	return b;
+	return b = b ^ d;
 }
 
-/// arithmetic substract
-inline Bitboard operator-(Bitboard b, Bitboard d)
+/// equality
+inline bool operator==(Bitboard b, Bitboard d)
 {
-	__m128i x = _mm_xor_si128(d.v, setone_si128.v);
-	if (overflow_l_epi64(x, one_si128.v))
-		x = _mm_add_epi64(x, one_epi64.v);
-	else
-		x = _mm_add_epi64(x, one_si128.v);
+	return !(b ^ d);
+}
 
-	if (overflow_l_epi64(b.v, x))
-	{
-		x = _mm_add_epi64(b.v, x);
-		x = _mm_add_epi64(x, carryone_si128.v);
-	}
-	else
-		x = _mm_add_epi64(b.v, x);
+inline bool operator!=(Bitboard b, Bitboard d)
+{
+	return bool(b ^ d);
+}
 
-	return x;
+/// arithmetic substract. The borrow out of the lower lane is a plain compare,
+/// so there is no data-dependent branch on any backend.
+inline Bitboard operator-(Bitboard b, Bitboard d)
+{
+#if defined(BB_INT128)
+	return Bitboard::from_u128(b.v - d.v);
+#else
+	uint64_t lo = b.lower(), dlo = d.lower();
+	return Bitboard(lo - dlo, b.upper() - d.upper() - (lo < dlo));
+#endif
 }
 
 inline Bitboard operator-(Bitboard b, int n)
@@ -275,9 +357,18 @@ inline Bitboard operator-(Bitboard b, int n)
 	return b - Bitboard(n);
 }
 
+/// reset_lsb() clears the least significant bit of a bitboard one 64 bit lane at
+/// a time, BLSR style: the upper lane is only modified when the lower one is
+/// empty, so unlike b & (b - 1) no borrow has to travel between the lanes.
+inline Bitboard reset_lsb(Bitboard b)
+{
+	uint64_t lo = b.lower(), hi = b.upper();
+	return Bitboard(lo & (lo - 1), hi & (hi - (lo == 0)));
+}
+
 inline bool more_than_one(Bitboard b)
 {
-	return b & (b - 1);
+	return bool(reset_lsb(b));
 }
 
 /// rank_bb() and file_bb() return a bitboard representing all the points on
@@ -365,7 +456,7 @@ inline Bitboard passed_pawn_mask(Color c, Square s)
 /// straight or on a diagonal line.
 inline bool aligned(Square s1, Square s2, Square s3)
 {
-	return LineBB[s1][s2] & s3;
+	return bool(LineBB[s1][s2] & s3);
 }
 
 /// distance() functions return the distance between x and y, defined as the
@@ -378,9 +469,13 @@ template<typename T1, typename T2> inline int distance(T2 x, T2 y) { return 0; }
 template<> inline int distance<File>(Square x, Square y) { return distance(file_of(x), file_of(y)); }
 template<> inline int distance<Rank>(Square x, Square y) { return distance(rank_of(x), rank_of(y)); }
 
-/// attacks_bb() returns a bitboard representing all the squares attacked by a
-/// piece of type Pt (bishop or rook) placed on 's'. The helper magic_index()
-/// looks up the index using the 'magic bitboards' approach.
+/// table_attacks() returns a bitboard representing all the squares attacked by
+/// a piece of type Pt placed on 's', looked up in the per square tables. The
+/// helper magic_index() computes the index with a 'magic' multiply of each lane
+/// of the masked occupancy, the two products xored before the shift, giving an
+/// index in [0, 2^popcount(mask)). Horses and elephants are always indexed this
+/// way: their masks have four bits and pext would not be any faster. Chariot
+/// and canon tables may be indexed with pext instead, see attacks_bb().
 template<PieceType Pt>
 inline unsigned magic_index(Square s, Bitboard occupied)
 {
@@ -388,18 +483,34 @@ inline unsigned magic_index(Square s, Bitboard occupied)
 	extern Bitboard CanonMasks[SQUARE_NB];
 	extern Bitboard HorseMasks[SQUARE_NB];
 	extern Bitboard ElephantMasks[SQUARE_NB];
+	extern uint64_t ChariotMagics[SQUARE_NB][2];
+	extern uint64_t CanonMagics[SQUARE_NB][2];
+	extern uint64_t HorseMagics[SQUARE_NB][2];
+	extern uint64_t ElephantMagics[SQUARE_NB][2];
+	extern unsigned ChariotShifts[SQUARE_NB];
+	extern unsigned CanonShifts[SQUARE_NB];
+	extern unsigned HorseShifts[SQUARE_NB];
+	extern unsigned ElephantShifts[SQUARE_NB];
+
+	const Bitboard* const Masks = Pt == CHARIOT ? ChariotMasks :
+								  Pt == CANON ? CanonMasks :
+								  Pt == HORSE ? HorseMasks : ElephantMasks;
 
-	Bitboard* const Masks = Pt == CHARIOT ? ChariotMasks :
-							Pt == CANON ? CanonMasks :
-							Pt == HORSE ? HorseMasks : ElephantMasks;
+	const uint64_t* const Magics = (Pt == CHARIOT ? ChariotMagics :
+									Pt == CANON ? CanonMagics :
+									Pt == HORSE ? HorseMagics : ElephantMagics)[s];
 
-	return unsigned(pext_si128(occupied.v, Masks[s].v));
+	const unsigned* const Shifts = Pt == CHARIOT ? ChariotShifts :
+								   Pt == CANON ? CanonShifts :
+								   Pt == HORSE ? HorseShifts : ElephantShifts;
+
+	occupied &= Masks[s];
+	return unsigned(((occupied.lower() * Magics[0]) ^ (occupied.upper() * Magics[1])) >> Shifts[s]);
 }
 
 template<PieceType Pt>
-inline Bitboard attacks_bb(Square s, Bitboard occupied)
+inline Bitboard table_attacks(Square s, Bitboard occupied)
 {
-
 	extern Bitboard* ChariotAttacks[SQUARE_NB];
 	extern Bitboard* CanonAttacks[SQUARE_NB];
 	extern Bitboard* HorseAttacks[SQUARE_NB];
@@ -412,6 +523,69 @@ inline Bitboard attacks_bb(Square s, Bitboard occupied)
 			Pt == HORSE ? HorseAttacks : ElephantAttacks)[s][idx];
 }
 
+/// LineTables holds the chariot [0] and canon [1] attacks along a rank or a
+/// file, for every inner occupancy of the line. It is computed at compile time.
+struct LineTables
+{
+	uint16_t rank[2][FILE_NB][128];
+	uint16_t file[2][RANK_NB][256];
+};
+
+extern const LineTables LineAttacks;
+
+/// line_attacks() returns the chariot or canon attacks from 's' as the union
+/// of a rank lookup and a file lookup, each indexed by the inner occupancy of
+/// its own line only (7 bits of the rank, 8 bits of the file). Everything is
+/// done on the two 64 bit lanes: the file points are 9 bits apart, so a single
+/// multiply gathers them into the index and another one spreads the 10 bit
+/// result back onto the file.
+template<PieceType Pt>
+inline Bitboard line_attacks(Square s, Bitboard occupied)
+{
+	const uint64_t Spread = 0x0101010101010101ULL;
+	const uint64_t FileALow = FileABB.lower();
+	const int t = Pt == CANON;
+	const int f = file_of(s), r = rank_of(s);
+	const uint64_t lo = occupied.lower(), hi = occupied.upper();
+
+	// The inner points of a rank never straddle the two lanes
+	unsigned rankIdx = unsigned(r < 7 ? lo >> (9 * r + 1) : hi >> (9 * r - 63)) & 0x7F;
+
+	// Ranks 8 to 10 of the file, as bits 0, 9 and 18 of 'up' shifted by 8
+	uint64_t up = hi << (9 - f);
+	unsigned fileIdx =  unsigned((((lo >> f) & FileALow) * Spread) >> 57)
+					  | unsigned((up >> 2) & 0x40) | unsigned((up >> 10) & 0x80);
+
+	uint64_t rankAtt = LineAttacks.rank[t][f][rankIdx];
+	uint64_t fileAtt = LineAttacks.file[t][r][fileIdx];
+
+	uint64_t lower =  (r < 8 ? rankAtt << (9 * r) : 0)
+					| ((((fileAtt & 0xFF) * Spread) & FileALow) << f);
+	uint64_t upper =  (r < 7 ? 0 : (rankAtt << (9 * r - 63)) >> 1)
+					| (((((fileAtt >> 7) & 7) * 0x10101) & 0x40201) << f >> 1);
+
+	return Bitboard(lower, upper);
+}
+
+/// attacks_bb() returns a bitboard representing all the squares attacked by a
+/// piece of type Pt placed on 's'. Chariots and canons use the small line
+/// tables unless the large per square tables have been selected, see the
+/// "PEXT Slider Tables" UCI option. These are then reached through SliderAttacks,
+/// set once at startup to lookups indexed with pext, compiled for BMI2, or with
+/// magics, so that no lookup has to test which scheme is in use.
+typedef Bitboard (*SliderLookup)(Square, Bitboard);
+
+template<PieceType Pt>
+inline Bitboard attacks_bb(Square s, Bitboard occupied)
+{
+	extern bool PextSliders;
+	extern SliderLookup SliderAttacks[2];
+
+	return Pt != CHARIOT && Pt != CANON ? table_attacks<Pt>(s, occupied)
+		 : !PextSliders ? line_attacks<Pt>(s, occupied)
+						: SliderAttacks[Pt == CANON](s, occupied);
+}
+
 inline Bitboard attacks_bb(Piece pc, Square s, Bitboard occupied)
 {
 
@@ -428,51 +602,52 @@ inline Bitboard attacks_bb(Piece pc, Square s, Bitboard occupied)
 /// popcount() counts the number of non-zero bits in a bitboard
 inline int popcount(Bitboard b)
 {
-	return (int)_mm_popcnt_u64(b.v.m128i_u64[1]) + (int)_mm_popcnt_u64(b.v.m128i_u64[0]);
+	return popcount64(b.upper()) + popcount64(b.lower());
 }
 
 /// lsb() and msb() return the least/most significant bit in a non-zero bitboard
 inline Square lsb(Bitboard b)
 {
-	unsigned long idx1, idx2;
+	if (b.lower())
+		return (Square)lsb64(b.lower());
 
-	if (b.v.m128i_u64[0])
-	{
-		_BitScanForward64(&idx1, b.v.m128i_u64[0]);
-		return (Square)idx1;
-	}
-
-	if (b.v.m128i_u64[1])
-	{
-		_BitScanForward64(&idx2, b.v.m128i_u64[1]);
-		return (Square)(idx2 + 64);
-	}
+	if (b.upper())
+		return (Square)(lsb64(b.upper()) + 64);
 
 	return (Square)0;
 }
 
 inline Square msb(Bitboard b)
 {
-	unsigned long idx1, idx2;
+	if (b.upper())
+		return (Square)(msb64(b.upper()) + 64);
 
-	if (b.v.m128i_u64[1])
-	{
-		_BitScanReverse64(&idx1, b.v.m128i_u64[1]);
-		return (Square)(idx1 + 64);
-	}
-
-	_BitScanReverse64(&idx2, b.v.m128i_u64[0]);
-	return (Square) idx2;
+	return (Square)msb64(b.lower());
 }
 
 /// pop_lsb() finds and clears the least significant bit in a non-zero bitboard
 inline Square pop_lsb(Bitboard* b)
 {
 	const Square s = lsb(*b);
-	*b = *b & (*b - 1);
+	*b = reset_lsb(*b);
 	return s;
 }
 
+/// BitboardIterator allows a range-for loop over the set squares of a bitboard,
+/// visited from the least significant one: for (Square s : b) { ... }. The
+/// iterator works on its own copy, consumed with reset_lsb().
+struct BitboardIterator
+{
+	Square operator*() const { return lsb(b); }
+	BitboardIterator& operator++() { b = reset_lsb(b); return *this; }
+	bool operator!=(const BitboardIterator&) const { return bool(b); } // Only compared to end()
+
+	Bitboard b;
+};
+
+inline BitboardIterator begin(Bitboard b) { return BitboardIterator{ b }; }
+inline BitboardIterator end(Bitboard) { return BitboardIterator{ Bitboard() }; }
+
 /// frontmost_sq() and backmost_sq() return the square corresponding to the
 /// most/least advanced bit relative to the given color.
 inline Square frontmost_sq(Color c, Bitboard b) { return c == WHITE ? msb(b) : lsb(b); }
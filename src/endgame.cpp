@@ -58,10 +58,10 @@ namespace
 		return sq;
 	}
 
-	// Get the material key of Position out of the given endgame key code
-	// like "KBPKN". The trick here is to first forge an ad-hoc FEN string
+	// Get the material table index of Position out of the given endgame key
+	// code like "KBPKN". The trick here is to first forge an ad-hoc FEN string
 	// and then let a Position object do the work for us.
-	Key key(const std::string& code, Color c) {
+	int key(const std::string& code, Color c) {
 
 		//assert(code.length() > 0 && code.length() < 8);
 		//assert(code[0] == 'K');
@@ -75,7 +75,7 @@ namespace
 			+ sides[1] + char(8 - sides[1].length() + '0') + " w - - 0 10";
 
 		StateInfo st;
-		return Position().set(fen, &st, nullptr).material_key();
+		return Position().set(fen, &st, nullptr).material_index();
 	}
 } // namespace
 
@@ -364,7 +364,7 @@ ScaleFactor Endgame<KQKRPs>::operator()(const Position& pos) const
 {
 
 	assert(verify_material(pos, strongSide, ChariotValueMg, 0));
-	assert(pos.count<CHARIOT>(weakSide) == 1);
+	assert(pos.count<CANON>(weakSide) == 1);
 	assert(pos.count<SOLDIER>(weakSide) >= 1);
 
 	Square kingSq = pos.square<GENERAL>(weakSide);
@@ -73,13 +73,15 @@ private:
 };
 
 /// The Endgames class stores the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+/// base objects in two std::map, keyed by the material table index of their
+/// configuration. We use polymorphism to invoke the actual endgame function by
+/// calling its virtual operator().
 class Endgames 
 {
+public:
+	template<typename T> using Map = std::map<int, std::unique_ptr<EndgameBase<T>>>;
 
-	template<typename T> using Map = std::map<Key, std::unique_ptr<EndgameBase<T>>>;
-
+private:
 	template<EndgameType E, typename T = eg_type<E>>
 	void add(const std::string& code);
 
@@ -94,8 +96,8 @@ public:
 	Endgames();
 
 	template<typename T>
-	EndgameBase<T>* probe(Key key) {
-		return map<T>().count(key) ? map<T>()[key].get() : nullptr;
+	const Map<T>& functions() {
+		return map<T>();
 	}
 };
 
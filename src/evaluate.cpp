@@ -2,6 +2,7 @@
 #include <iomanip>
 #include <sstream>
 #include <cassert>
+#include <cstring> // For std::memset
 
 #include "bitboard.h"
 #include "evaluate.h"
@@ -874,4 +875,50 @@ std::string Eval::trace(const Position& pos)
 	ss << "\nTotal Evaluation: " << to_cp(v) << " (white side)\n";
 
 	return ss.str();
-}
\ No newline at end of file
+}
+
+/// Cache::resize() sets the number of entries to the largest power of 2 that
+/// fits in kbSize kilobytes. The content is lost.
+
+void Eval::Cache::resize(size_t kbSize)
+{
+
+	size_t entries = kbSize * 1024 / sizeof(Entry);
+
+	entries = entries ? size_t(1) << msb(entries) : 0;
+
+	if (entries != table.size())
+		table.assign(entries, Entry());
+
+	clear();
+}
+
+/// Cache::clear() empties the cache and resets its counters
+
+void Eval::Cache::clear()
+{
+
+	std::memset(table.data(), 0, table.size() * sizeof(Entry));
+	probes = hits = 0;
+}
+
+/// Cache::evaluate() returns the static evaluation of the position from the
+/// cache, calling Eval::evaluate() on a miss and storing the result.
+
+Value Eval::Cache::evaluate(const Position& pos)
+{
+
+	if (table.empty())
+		return Eval::evaluate(pos);
+
+	Entry& e = table[(size_t)pos.key() & (table.size() - 1)];
+	const uint32_t key32 = pos.key() >> 32;
+
+	++probes;
+
+	if (e.key32 == key32)
+		return ++hits, Value(e.value);
+
+	e.key32 = key32;
+	return Value(e.value = Eval::evaluate(pos));
+}
@@ -2,6 +2,7 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -16,6 +17,35 @@ namespace Eval
 
 	template<bool DoTrace = false>
 	Value evaluate(const Position& pos);
+
+	/// Cache is a direct-mapped table of static evaluations, one per thread and
+	/// indexed by the low bits of the position key, while the high 32 bits are
+	/// kept to check the entry. Its size is the "Eval Cache" option, measured
+	/// in kilobytes, and a zero size turns it off.
+
+	class Cache 
+	{
+
+		struct Entry 
+		{
+			uint32_t key32;
+			int32_t value;
+		};
+
+	public:
+		void resize(size_t kbSize);
+		void clear();
+		Value evaluate(const Position& pos);
+		uint64_t probes, hits;
+
+		// The entry of a key, to prefetch it. nullptr when the cache is off.
+		const void* entry(Key key) const {
+			return table.empty() ? nullptr : &table[(size_t)key & (table.size() - 1)];
+		}
+
+	private:
+		std::vector<Entry> table;
+	};
 }
 
 
@@ -1,6 +1,10 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <string>
 
 #include "bitboard.h"
+#include "material.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -12,22 +16,59 @@ namespace PSQT
 	void init();
 }
 
+namespace
+{
+	/// StartupProfile times the init phases run at startup and reports them
+	/// when the engine is started with "--startup-profile" as first argument.
+
+	struct StartupProfile
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		template<typename F>
+		void operator()(const char* phase, F init)
+		{
+			Clock::time_point t = Clock::now();
+			init();
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+			total += ms;
+
+			if (enabled)
+				std::cout << "Startup " << std::setw(10) << std::left << phase
+						  << std::fixed << std::setprecision(3)
+						  << std::setw(10) << std::right << ms << " ms" << std::endl;
+		}
+
+		bool enabled;
+		double total = 0;
+	};
+}
+
 int main(int argc, char* argv[])
 {
 	std::cout << engine_info() << std::endl;
 
-	UCI::init(Options);
-	PSQT::init();
-	Bitboards::init();
-	Position::init();
-	Bitbases::init();
-	Search::init();
-	Pawns::init();
-	Threads.init();
-	TT.resize(Options["Hash"]);
+	StartupProfile profile = { argc > 1 && std::string(argv[1]) == "--startup-profile" };
+
+	if (profile.enabled)
+		argv[1] = argv[0], --argc, ++argv;
+
+	profile("UCI",       [] { UCI::init(Options); });
+	profile("PSQT",      [] { PSQT::init(); });
+	profile("Bitboards", [] { Bitboards::init(); });
+	profile("Position",  [] { Position::init(); });
+	profile("Material",  [] { Material::init(); });
+	profile("Search",    [] { Search::init(); });
+	profile("Pawns",     [] { Pawns::init(); });
+	profile("Threads",   [] { Threads.init(); });
+	profile("Hash",      [] { TT.resize(Options["Hash"]); });
+
+	if (profile.enabled)
+		std::cout << "Startup Bitbases    deferred to the first KPK probe\n"
+				  << "Startup total     " << std::setw(10) << profile.total << " ms" << std::endl;
 
 	UCI::loop(argc, argv);
 
 	Threads.exit();
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring> // For std::memset
+#include <memory>
+#include <vector>
+
 #include "endgame.h"
 #include "material.h"
 #include "thread.h"
@@ -41,27 +48,57 @@ namespace
 	Endgame<KPsK>   ScaleKPsK[] = { Endgame<KPsK>(WHITE),   Endgame<KPsK>(BLACK) };
 	Endgame<KPKP>   ScaleKPKP[] = { Endgame<KPKP>(WHITE),   Endgame<KPKP>(BLACK) };
 
+	// Every table entry refers to its endgame functions by a small index into
+	// these lists. Index 0 stands for no function. Material::init() registers
+	// all the functions, so threads filling in entries only read the lists.
+	std::unique_ptr<Endgames> EndgameMaps;
+	std::vector<EndgameBase<Value>*> EvaluationFunctions(1);
+	std::vector<EndgameBase<ScaleFactor>*> ScalingFunctions(1);
+
+	template<typename T>
+	uint8_t function_index(const std::vector<EndgameBase<T>*>& functions, EndgameBase<T>* f)
+	{
+		size_t idx = std::find(functions.begin(), functions.end(), f) - functions.begin();
+
+		assert(idx < functions.size() && idx < 256);
+		return uint8_t(idx);
+	}
+
+	// State of each table entry. An entry is claimed by the first thread that
+	// probes it and can be read once it is marked as filled.
+	enum EntryState : uint8_t { EMPTY, FILLING, FILLED };
+
+	std::atomic<uint8_t> States[Material::TableSize];
+
+	// Material counts of both sides, count[c][ALL_PIECES] being the number of
+	// pieces besides the general, and their non-pawn material.
+	struct Config
+	{
+		int count[COLOR_NB][PIECE_TYPE_NB];
+		Value npm[COLOR_NB];
+	};
+
 	// Helper used to detect a given material distribution
-	bool is_KXK(const Position& pos, Color us) 
+	bool is_KXK(const Config& cfg, Color us) 
 	{
-		return  !more_than_one(pos.pieces(~us))
-			&& pos.non_pawn_material(us) >= ChariotValueMg;
+		return   cfg.count[~us][ALL_PIECES] == 0
+			&& cfg.npm[us] >= ChariotValueMg;
 	}
 
-	bool is_KBPsKs(const Position& pos, Color us) 
+	bool is_KBPsKs(const Config& cfg, Color us) 
 	{
-		return   pos.non_pawn_material(us) == ElephantValueMg
-			&& pos.count<ELEPHANT>(us) == 1
-			&& pos.count<SOLDIER  >(us) >= 1;
+		return   cfg.npm[us] == ElephantValueMg
+			&& cfg.count[us][ELEPHANT] == 1
+			&& cfg.count[us][SOLDIER ] >= 1;
 	}
 
-	bool is_KQKRPs(const Position& pos, Color us) 
+	bool is_KQKRPs(const Config& cfg, Color us) 
 	{
-		return  !pos.count<SOLDIER>(us)
-			&& pos.non_pawn_material(us) == ChariotValueMg
-			&& pos.count<CHARIOT>(us) == 1
-			&& pos.count<CANON>(~us) == 1
-			&& pos.count<SOLDIER>(~us) >= 1;
+		return  !cfg.count[us][SOLDIER]
+			&& cfg.npm[us] == ChariotValueMg
+			&& cfg.count[us][CHARIOT] == 1
+			&& cfg.count[~us][CANON] == 1
+			&& cfg.count[~us][SOLDIER] >= 1;
 	}
 
 	/// imbalance() calculates the imbalance by comparing the piece count of each
@@ -90,113 +127,274 @@ namespace
 
 		return bonus;
 	}
-} // namespace
 
-namespace Material
-{
+	/// reset() clears the entry back to a plain material configuration with no
+	/// endgame function, keeping only its game phase.
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
+	void reset(Material::Entry* e)
+	{
+		uint8_t gamePhase = e->gamePhase;
 
-Entry* probe(const Position& pos)
-{
-	Key key = pos.material_key();
-	Entry* e = pos.this_thread()->materialTable[key];
+		std::memset(e, 0, sizeof(Material::Entry));
+		e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+		e->gamePhase = gamePhase;
+	}
 
-	if (e->key == key)
-		return e;
+	/// compute() fills in the entry of a material configuration from the generic
+	/// rules. Endgame functions of specific configurations are applied on top of
+	/// it by fill().
 
-	std::memset(e, 0, sizeof(Entry));
-	e->key = key;
-	e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
-	e->gamePhase = pos.game_phase();
+	void compute(Material::Entry* e, const Config& cfg)
+	{
+		Value npm_w = cfg.npm[WHITE];
+		Value npm_b = cfg.npm[BLACK];
+		Value npm = std::max(EndgameLimit, std::min(npm_w + npm_b, MidgameLimit));
+
+		e->gamePhase = uint8_t(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
+		reset(e);
+
+		// Let's look if we have a generic evaluation function for this material
+		// configuration.
+		for (Color c = WHITE; c <= BLACK; ++c)
+			if (is_KXK(cfg, c))
+			{
+				e->evaluationFunction = function_index<Value>(EvaluationFunctions, &EvaluateKXK[c]);
+				return;
+			}
+
+		// OK, we didn't find any special evaluation function for the current material
+		// configuration, so fall back on generic scaling functions that refer to
+		// more than one material distribution. Note that in this case we don't
+		// return after setting the function.
+		for (Color c = WHITE; c <= BLACK; ++c)
+		{
+			if (is_KBPsKs(cfg, c))
+				e->scalingFunction[c] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKBPsK[c]);
 
-	// Let's look if we have a specialized evaluation function for this particular
-	// material configuration. Firstly we look for a fixed configuration one, then
-	// for a generic one if the previous search failed.
-	if ((e->evaluationFunction = pos.this_thread()->endgames.probe<Value>(key)) != nullptr)
-		return e;
+			else if (is_KQKRPs(cfg, c))
+				e->scalingFunction[c] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKQKRPs[c]);
+		}
 
-	for (Color c = WHITE; c <= BLACK; ++c)
-		if (is_KXK(pos, c))
+		int soldiers_w = cfg.count[WHITE][SOLDIER];
+		int soldiers_b = cfg.count[BLACK][SOLDIER];
+
+		if (npm_w + npm_b == VALUE_ZERO && (soldiers_w || soldiers_b)) // Only pawns on the board
 		{
-			e->evaluationFunction = &EvaluateKXK[c];
-			return e;
+			if (!soldiers_b)
+				e->scalingFunction[WHITE] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKPsK[WHITE]);
+
+			else if (!soldiers_w)
+				e->scalingFunction[BLACK] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKPsK[BLACK]);
+
+			else if (soldiers_w == 1 && soldiers_b == 1)
+			{
+				// This is a special case because we set scaling functions
+				// for both colors instead of only one.
+				e->scalingFunction[WHITE] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKPKP[WHITE]);
+				e->scalingFunction[BLACK] = function_index<ScaleFactor>(ScalingFunctions, &ScaleKPKP[BLACK]);
+			}
 		}
 
-	// OK, we didn't find any special evaluation function for the current material
-	// configuration. Is there a suitable specialized scaling function?
-	EndgameBase<ScaleFactor>* sf;
+		// Zero or just one pawn makes it difficult to win, even with a small material
+		// advantage. This catches some trivial draws like KK, KBK and KNK and gives a
+		// drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
+		if (!soldiers_w && npm_w - npm_b <= ElephantValueMg)
+			e->factor[WHITE] = uint8_t(npm_w <  ChariotValueMg ? SCALE_FACTOR_DRAW :
+				npm_b <= ElephantValueMg ? 4 : 14);
+
+		if (!soldiers_b && npm_b - npm_w <= ElephantValueMg)
+			e->factor[BLACK] = uint8_t(npm_b <  ChariotValueMg ? SCALE_FACTOR_DRAW :
+				npm_w <= ElephantValueMg ? 4 : 14);
+
+		if (soldiers_w == 1 && npm_w - npm_b <= ElephantValueMg)
+			e->factor[WHITE] = (uint8_t)SCALE_FACTOR_ONEPAWN;
 
-	if ((sf = pos.this_thread()->endgames.probe<ScaleFactor>(key)) != nullptr)
+		if (soldiers_b == 1 && npm_b - npm_w <= ElephantValueMg)
+			e->factor[BLACK] = (uint8_t)SCALE_FACTOR_ONEPAWN;
+	}
+
+	/// piece_counts() sets up the counts used by imbalance(). We use
+	/// PIECE_TYPE_NONE as a place holder for the bishop pair "extended piece",
+	/// which allows us to be more flexible in defining bishop pair bonuses.
+	void piece_counts(const int count[PIECE_TYPE_NB], int pieceCount[PIECE_TYPE_NB])
 	{
-		e->scalingFunction[sf->strong_side()] = sf; // Only strong color assigned
-		return e;
+		pieceCount[NO_PIECE_TYPE] = count[ELEPHANT] > 1;
+
+		for (PieceType pt = SOLDIER; pt <= CHARIOT; ++pt)
+			pieceCount[pt] = count[pt];
 	}
 
-	// We didn't find any specialized scaling function, so fall back on generic
-	// ones that refer to more than one material distribution. Note that in this
-	// case we don't return after setting the function.
-	for (Color c = WHITE; c <= BLACK; ++c)
+	/// material_imbalance() evaluates the material imbalance of a configuration
+	int material_imbalance(const Config& cfg)
 	{
-		if (is_KBPsKs(pos, c))
-			e->scalingFunction[c] = &ScaleKBPsK[c];
+		int PieceCount[COLOR_NB][PIECE_TYPE_NB] = {};
+
+		piece_counts(cfg.count[WHITE], PieceCount[WHITE]);
+		piece_counts(cfg.count[BLACK], PieceCount[BLACK]);
 
-		else if (is_KQKRPs(pos, c))
-			e->scalingFunction[c] = &ScaleKQKRPs[c];
+		return (imbalance<WHITE>(PieceCount) - imbalance<BLACK>(PieceCount)) / 16;
 	}
 
-	Value npm_w = pos.non_pawn_material(WHITE);
-	Value npm_b = pos.non_pawn_material(BLACK);
+	/// config() returns the material counts of the position
+	Config config(const Position& pos)
+	{
+		Config cfg = {};
+
+		for (Piece pc : Pieces)
+		{
+			Color c = color_of(pc);
+			PieceType pt = type_of(pc);
+			int cnt = popcount(pos.pieces(c, pt));
+
+			if (pt != GENERAL)
+				cfg.count[c][pt] = cnt, cfg.count[c][ALL_PIECES] += cnt;
+		}
+
+		cfg.npm[WHITE] = pos.non_pawn_material(WHITE);
+		cfg.npm[BLACK] = pos.non_pawn_material(BLACK);
+		return cfg;
+	}
 
-	if (npm_w + npm_b == VALUE_ZERO && pos.pieces(SOLDIER)) // Only pawns on the board
+	/// config() returns the material counts of a table index
+	Config config(int idx)
 	{
-		if (!pos.count<SOLDIER>(BLACK))
-		{			
-			e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
+		Config cfg = {};
+
+		for (Piece pc : Pieces)
+		{
+			Color c = color_of(pc);
+			PieceType pt = type_of(pc);
+
+			if (!Material::MaxPieceCount[pt])
+				continue;
+
+			int cnt = idx / Material::IndexStride[pc] % (Material::MaxPieceCount[pt] + 1);
+
+			cfg.count[c][pt] = cnt, cfg.count[c][ALL_PIECES] += cnt;
+
+			if (pt != SOLDIER)
+				cfg.npm[c] += cnt * PieceValue[MG][pc];
 		}
-		else if (!pos.count<SOLDIER>(WHITE))
-		{			
-			e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
+
+		return cfg;
+	}
+
+	/// fill() sets up the table entry of a material index. Specialized scaling
+	/// functions override the generic rules unless there is an evaluation
+	/// function, and specialized evaluation functions override all.
+	void fill(Material::Entry* e, int idx)
+	{
+		Config cfg = config(idx);
+
+		compute(e, cfg);
+		e->value = int16_t(material_imbalance(cfg));
+
+		const auto& evaluations = EndgameMaps->functions<Value>();
+		const auto& scalings = EndgameMaps->functions<ScaleFactor>();
+		auto ev = evaluations.find(idx);
+		auto sc = scalings.find(idx);
+
+		if (ev != evaluations.end())
+		{
+			reset(e);
+			e->evaluationFunction = function_index<Value>(EvaluationFunctions, ev->second.get());
 		}
-		else if (pos.count<SOLDIER>(WHITE) == 1 && pos.count<SOLDIER>(BLACK) == 1)
+		else if (sc != scalings.end() && !e->evaluationFunction)
 		{
-			// This is a special case because we set scaling functions
-			// for both colors instead of only one.
-			e->scalingFunction[WHITE] = &ScaleKPKP[WHITE];
-			e->scalingFunction[BLACK] = &ScaleKPKP[BLACK];
+			// Only strong color assigned
+			reset(e);
+			e->scalingFunction[sc->second->strong_side()] = function_index<ScaleFactor>(ScalingFunctions, sc->second.get());
 		}
 	}
+} // namespace
+
+namespace Material
+{
+
+int IndexStride[PIECE_NB];
+Entry Table[TableSize];
+
+Value Entry::evaluate(const Position& pos) const
+{
+	return (*EvaluationFunctions[evaluationFunction])(pos);
+}
+
+ScaleFactor Entry::scale_factor(const Position& pos, Color c) const
+{
+	ScaleFactor sf = scalingFunction[c] ? (*ScalingFunctions[scalingFunction[c]])(pos)
+		: SCALE_FACTOR_NONE;
+	return sf != SCALE_FACTOR_NONE ? sf : ScaleFactor(factor[c]);
+}
+
+/// Material::init() sets up the table index and registers the endgame
+/// functions. The entries themselves are filled in by Material::probe(). It
+/// must be called after Position::init(), because the endgame maps are set up
+/// from FEN strings.
+
+void init()
+{
+	int size = 1;
+
+	for (Piece pc : Pieces)
+	{
+		IndexStride[pc] = MaxPieceCount[type_of(pc)] ? size : 0;
+		size *= MaxPieceCount[type_of(pc)] + 1;
+	}
+
+	assert(size == TableSize);
+
+	EndgameMaps = std::unique_ptr<Endgames>(new Endgames());
+
+	for (Color c = WHITE; c <= BLACK; ++c)
+	{
+		EvaluationFunctions.push_back(&EvaluateKXK[c]);
+		ScalingFunctions.push_back(&ScaleKBPsK[c]);
+		ScalingFunctions.push_back(&ScaleKQKRPs[c]);
+		ScalingFunctions.push_back(&ScaleKPsK[c]);
+		ScalingFunctions.push_back(&ScaleKPKP[c]);
+	}
+
+	for (const auto& f : EndgameMaps->functions<Value>())
+		EvaluationFunctions.push_back(f.second.get());
+
+	for (const auto& f : EndgameMaps->functions<ScaleFactor>())
+		ScalingFunctions.push_back(f.second.get());
+}
+
+/// Material::probe() returns the entry of the position's material configuration
+/// straight out of the table. The first thread to reach an empty entry fills
+/// it in, while others reaching it at the same time compute their own copy.
+/// Positions with more pieces than a side can start miss the table and get
+/// their entry computed in place as well.
+
+Entry* probe(const Position& pos)
+{
+	int idx = pos.material_index();
+
+	if (idx < IndexOverflow)
+	{
+		if (States[idx].load(std::memory_order_acquire) == FILLED)
+			return &Table[idx];
+
+		uint8_t state = EMPTY;
+
+		if (States[idx].compare_exchange_strong(state, FILLING, std::memory_order_relaxed))
+		{
+			fill(&Table[idx], idx);
+			States[idx].store(FILLED, std::memory_order_release);
+			return &Table[idx];
+		}
+
+		Entry* e = &pos.this_thread()->materialEntry;
+		fill(e, idx);
+		return e;
+	}
+
+	Entry* e = &pos.this_thread()->materialEntry;
+	Config cfg = config(pos);
 
-	// Zero or just one pawn makes it difficult to win, even with a small material
-	// advantage. This catches some trivial draws like KK, KBK and KNK and gives a
-	// drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
-	if (!pos.count<SOLDIER>(WHITE) && npm_w - npm_b <= ElephantValueMg)
-		e->factor[WHITE] = uint8_t(npm_w <  ChariotValueMg ? SCALE_FACTOR_DRAW :
-			npm_b <= ElephantValueMg ? 4 : 14);
-
-	if (!pos.count<SOLDIER>(BLACK) && npm_b - npm_w <= ElephantValueMg)
-		e->factor[BLACK] = uint8_t(npm_b <  ChariotValueMg ? SCALE_FACTOR_DRAW :
-			npm_w <= ElephantValueMg ? 4 : 14);
-
-	if (pos.count<SOLDIER>(WHITE) == 1 && npm_w - npm_b <= ElephantValueMg)
-		e->factor[WHITE] = (uint8_t)SCALE_FACTOR_ONEPAWN;
-
-	if (pos.count<SOLDIER>(BLACK) == 1 && npm_b - npm_w <= ElephantValueMg)
-		e->factor[BLACK] = (uint8_t)SCALE_FACTOR_ONEPAWN;
-
-	// Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
-	// for the bishop pair "extended piece", which allows us to be more flexible
-	// in defining bishop pair bonuses.
-	const int PieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-		{ pos.count<ELEPHANT>(WHITE) > 1, pos.count<SOLDIER>(WHITE), pos.count<HORSE>(WHITE),
-		pos.count<ELEPHANT>(WHITE)    , pos.count<CANON>(WHITE), pos.count<CHARIOT >(WHITE) },
-		{ pos.count<ELEPHANT>(BLACK) > 1, pos.count<SOLDIER>(BLACK), pos.count<HORSE>(BLACK),
-		pos.count<ELEPHANT>(BLACK)    , pos.count<CANON>(BLACK), pos.count<CHARIOT >(BLACK) } };
-
-	e->value = int16_t((imbalance<WHITE>(PieceCount) - imbalance<BLACK>(PieceCount)) / 16);
+	compute(e, cfg);
+	e->value = int16_t(material_imbalance(cfg));
 	return e;
 }
 }
\ No newline at end of file
@@ -2,7 +2,6 @@
 #define MATERIAL_H_INCLUDED
 
 #include "endgame.h"
-#include "misc.h"
 #include "position.h"
 #include "types.h"
 
@@ -21,33 +20,53 @@ namespace Material
 struct Entry {
 
 	Score imbalance() const { return make_score(value, value); }
-	Phase game_phase() const { return gamePhase; }
-	bool specialized_eval_exists() const { return evaluationFunction != nullptr; }
-	Value evaluate(const Position& pos) const { return (*evaluationFunction)(pos); }
+	Phase game_phase() const { return Phase(gamePhase); }
+	bool specialized_eval_exists() const { return evaluationFunction != 0; }
+	Value evaluate(const Position& pos) const;
 
 	// scale_factor takes a position and a color as input and returns a scale factor
 	// for the given color. We have to provide the position in addition to the color
 	// because the scale factor may also be a function which should be applied to
 	// the position. For instance, in KBP vs K endgames, the scaling function looks
 	// for rook pawns and wrong-colored bishops.
-	ScaleFactor scale_factor(const Position& pos, Color c) const {
-		ScaleFactor sf = scalingFunction[c] ? (*scalingFunction[c])(pos)
-			: SCALE_FACTOR_NONE;
-		return sf != SCALE_FACTOR_NONE ? sf : ScaleFactor(factor[c]);
-	}
+	ScaleFactor scale_factor(const Position& pos, Color c) const;
 
-	Key key;
 	int16_t value;
 	uint8_t factor[COLOR_NB];
-	EndgameBase<Value>* evaluationFunction;
-	EndgameBase<ScaleFactor>* scalingFunction[COLOR_NB]; // Could be one for each
-															// side (e.g. KPKP, KBPsKs)
-	Phase gamePhase;
+	uint8_t gamePhase;
+	uint8_t evaluationFunction;          // Index into the evaluation functions, 0 if none
+	uint8_t scalingFunction[COLOR_NB];   // Could be one for each side (e.g. KPKP, KBPsKs)
 };
 
-typedef HashTable<Entry, 8192> Table;
+/// Material configurations are indexed directly by their piece counts. Every
+/// piece but the general is a digit of a mixed radix number, with soldiers
+/// counting 0-5 and the other pieces 0-2 for each side. Position keeps the
+/// index in StateInfo and updates it on captures. A position set up with more
+/// pieces than that gets IndexOverflow added and is evaluated off the table.
+/// Entries are computed the first time a search probes them, so only the few
+/// configurations a game reaches ever take up memory.
 
+constexpr int MaxPieceCount[PIECE_TYPE_NB] = { 0, 5, 2, 2, 2, 2, 2, 0, 0 };
+const int IndexOverflow = 1 << 30;
+
+constexpr int side_size(int pt = 0) {
+	return pt == PIECE_TYPE_NB ? 1 : (MaxPieceCount[pt] + 1) * side_size(pt + 1);
+}
+
+const int TableSize = side_size() * side_size();
+
+extern int IndexStride[PIECE_NB];
+extern Entry Table[TableSize];
+
+void init();
 Entry* probe(const Position& pos);
+
+/// entry() returns the table entry of a material index, or nullptr when the
+/// index is overflowed. Used to prefetch the entry of a child position.
+
+inline const Entry* entry(int idx) {
+	return idx < IndexOverflow ? &Table[idx] : nullptr;
+}
 }
 
 #endif
\ No newline at end of file
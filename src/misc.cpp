@@ -1,7 +1,34 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
+#if defined(_WIN32)
+#	if !defined(NOMINMAX)
+#		define NOMINMAX // Disable macros min() and max()
+#	endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#	if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#	endif
+#endif
 
 #include "misc.h"
 #include "thread.h"
@@ -96,7 +123,9 @@ const string engine_info(bool to_uci) {
 	}
 
 	ss  << " x64"
-		<< " BMI2"
+		<< " " << Bitboards::index_backend()
+		<< (cpu_has_avx2() ? " AVX2" : "")
+		<< " " << BB_BACKEND
 		<< (to_uci ? "\nid author " : " by ")
 		<< "T. Romstad, M. Costalba, J. Kiiski, G. Linscott";
 
@@ -128,4 +157,495 @@ void start_logger(const std::string& fname)
 void prefetch(void* addr)
 {
 	_mm_prefetch((char*)addr, _MM_HINT_T0);
+}
+/// cpu_has_fast_pext() tells whether the attack tables should be indexed with
+/// pext. The CPU must support BMI2, and AMD before Zen 3 (families 17h and
+/// Hygon 18h) runs pext in microcode, far slower than a multiply. Compile with
+/// -DNO_PEXT to always use the magic multiply indices.
+
+bool cpu_has_fast_pext()
+{
+	static const bool fast = [] {
+
+#if defined(NO_PEXT)
+		return false;
+#else
+		unsigned regs[4], vendor[3];
+
+#	if defined(_MSC_VER)
+		auto cpuid = [&](unsigned leaf) { __cpuidex((int*)regs, leaf, 0); };
+#	else
+		auto cpuid = [&](unsigned leaf) { __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]); };
+#	endif
+
+		cpuid(0);
+		unsigned maxLeaf = regs[0];
+		vendor[0] = regs[1], vendor[1] = regs[3], vendor[2] = regs[2];
+
+		if (maxLeaf < 7)
+			return false;
+
+		cpuid(7);
+		if (!(regs[1] & (1 << 8))) // EBX bit 8: BMI2
+			return false;
+
+		cpuid(1);
+		unsigned family = (regs[0] >> 8) & 0xF;
+		if (family == 0xF)
+			family += (regs[0] >> 20) & 0xFF;
+
+		bool amd =   !memcmp(vendor, "AuthenticAMD", 12)
+				  || !memcmp(vendor, "HygonGenuine", 12);
+
+		return !(amd && (family == 0x17 || family == 0x18));
+#endif
+	}();
+
+	return fast;
+}
+
+/// cpu_has_avx2() tells whether the CPU runs AVX2 and the OS saves the YMM
+/// registers. Compile with -DNO_AVX2 to always use the scalar code.
+
+bool cpu_has_avx2()
+{
+	static const bool avx2 = [] {
+
+#if defined(NO_AVX2)
+		return false;
+#else
+		unsigned regs[4];
+
+#	if defined(_MSC_VER)
+		auto cpuid = [&](unsigned leaf) { __cpuidex((int*)regs, leaf, 0); };
+#	else
+		auto cpuid = [&](unsigned leaf) { __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]); };
+#	endif
+
+		cpuid(0);
+		if (regs[0] < 7)
+			return false;
+
+		cpuid(1);
+		if (!(regs[2] & (1 << 27))) // ECX bit 27: OSXSAVE
+			return false;
+
+#	if defined(_MSC_VER)
+		unsigned xcr0 = unsigned(_xgetbv(0));
+#	else
+		unsigned xcr0, edx;
+		__asm__("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+#	endif
+
+		if ((xcr0 & 6) != 6) // XMM and YMM state
+			return false;
+
+		cpuid(7);
+		return bool(regs[1] & (1 << 5)); // EBX bit 5: AVX2
+#endif
+	}();
+
+	return avx2;
+}
+
+namespace
+{
+
+#if defined(__linux__)
+
+	// Numbers listed in a sysfs file like "0-1" or "0,2-3", as are the online
+	// NUMA nodes and the CPUs of a node.
+	std::vector<int> read_list(const string& path)
+	{
+		std::vector<int> list;
+		ifstream file(path);
+		string range;
+
+		while (getline(file, range, ','))
+		{
+			int first, last;
+			char dash;
+			istringstream ss(range);
+
+			if (!(ss >> first))
+				break;
+
+			last = (ss >> dash >> last) ? last : first;
+
+			for (int n = first; n <= last; ++n)
+				list.push_back(n);
+		}
+
+		return list;
+	}
+
+	std::vector<int> online_numa_nodes()
+	{
+		return read_list("/sys/devices/system/node/online");
+	}
+
+	// Sets MPOL_INTERLEAVE over all online nodes for the still untouched pages.
+	// Calls mbind directly so that we don't depend on libnuma.
+	int interleave_pages(void* mem, size_t size)
+	{
+		const int MpolInterleave = 3;
+		std::vector<int> nodes = online_numa_nodes();
+		unsigned long mask[16] = {};
+
+		if (nodes.size() < 2)
+			return 0;
+
+		for (int n : nodes)
+			if (n < 16 * 64)
+				mask[n / 64] |= 1UL << (n % 64);
+
+		return syscall(SYS_mbind, mem, size, MpolInterleave, mask, 16 * 64, 0) ? 0 : int(nodes.size());
+	}
+
+#endif
+
+#if defined(_WIN32)
+
+	// Large pages need the "Lock pages in memory" privilege, which has to be
+	// enabled in the process token before VirtualAlloc() accepts MEM_LARGE_PAGES.
+	void* alloc_windows_large_pages(size_t& size)
+	{
+		HANDLE token;
+		TOKEN_PRIVILEGES tp;
+		void* mem = nullptr;
+		size_t pageSize = GetLargePageMinimum();
+
+		if (!pageSize || !OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+			return nullptr;
+
+		if (LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid))
+		{
+			tp.PrivilegeCount = 1;
+			tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+			if (   AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr)
+				&& GetLastError() == ERROR_SUCCESS)
+			{
+				size_t rounded = (size + pageSize - 1) & ~(pageSize - 1);
+				mem = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+				if (mem)
+					size = rounded;
+
+				tp.Privileges[0].Attributes = 0;
+				AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr);
+			}
+		}
+
+		CloseHandle(token);
+		return mem;
+	}
+
+#endif
+
+} // namespace
+
+/// alloc_large() allocates zeroed, page aligned memory for big tables like the
+/// transposition table. With hugePages set it tries explicit huge pages first
+/// (1 GB pages for blocks of 1 GB and more, then 2 MB ones), and otherwise
+/// asks for transparent huge pages. With interleave set the pages are spread
+/// round robin over the NUMA nodes. The size is rounded up to a multiple of the
+/// page size obtained, and info tells what we actually got.
+
+void* alloc_large(size_t& size, bool hugePages, bool interleave, string& info)
+{
+	const size_t MB = 1024 * 1024;
+	void* mem = nullptr;
+
+	info.clear();
+
+#if defined(_WIN32)
+
+	if (hugePages && (mem = alloc_windows_large_pages(size)) != nullptr)
+		info = std::to_string(GetLargePageMinimum() / MB) + " MB large pages";
+
+	if (!mem)
+	{
+		mem = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		info = "4 KB pages";
+	}
+
+	if (interleave)
+		info += ", NUMA interleave not supported";
+
+#else
+
+#	if defined(MAP_HUGETLB)
+	const struct { size_t pageSize; int flags; const char* name; } HugeTLB[] = {
+#		if defined(MAP_HUGE_1GB)
+		{ 1024 * MB, MAP_HUGETLB | MAP_HUGE_1GB, "1 GB huge pages" },
+#		endif
+		{    2 * MB, MAP_HUGETLB,                "2 MB huge pages" }
+	};
+
+	if (hugePages)
+		for (const auto& h : HugeTLB)
+		{
+			if (size < h.pageSize)
+				continue;
+
+			size_t rounded = (size + h.pageSize - 1) & ~(h.pageSize - 1);
+			mem = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | h.flags, -1, 0);
+
+			if (mem == MAP_FAILED)
+				mem = nullptr;
+			else
+			{
+				size = rounded, info = h.name;
+				break;
+			}
+		}
+#	endif
+
+	if (!mem)
+	{
+		// Round to 2 MB, so that transparent huge pages can back all of it
+		size = (size + 2 * MB - 1) & ~(2 * MB - 1);
+		mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mem == MAP_FAILED)
+			return nullptr;
+
+		info = "4 KB pages";
+
+#	if defined(MADV_HUGEPAGE)
+		if (hugePages && !madvise(mem, size, MADV_HUGEPAGE))
+			info = "transparent huge pages";
+#	endif
+	}
+
+	if (interleave)
+	{
+#	if defined(__linux__)
+		int nodes = interleave_pages(mem, size);
+		info += nodes ? ", interleaved over " + std::to_string(nodes) + " NUMA nodes"
+					  : ", single NUMA node";
+#	else
+		info += ", NUMA interleave not supported";
+#	endif
+	}
+
+#endif
+
+	return mem;
+}
+
+/// free_large() releases memory from alloc_large(), given the rounded size
+
+void free_large(void* mem, size_t size)
+{
+	if (!mem)
+		return;
+
+#if defined(_WIN32)
+	(void)size;
+	VirtualFree(mem, 0, MEM_RELEASE);
+#else
+	munmap(mem, size);
+#endif
+}
+
+/// map_shared() maps the named shared memory segment, so that several engine
+/// processes can work on the same table. If the segment doesn't exist yet it
+/// is created zeroed with the given size and created is set. Otherwise size
+/// is set to the size of the existing segment, once its creator has set it.
+/// On POSIX systems the segment outlives the processes until remove_shared()
+/// is called. Returns nullptr on failure.
+
+void* map_shared(const string& name, size_t& size, bool& created)
+{
+#if defined(_WIN32)
+
+	HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+								  DWORD(uint64_t(size) >> 32), DWORD(size), ("Local\\" + name).c_str());
+	if (!h)
+		return nullptr;
+
+	created = GetLastError() != ERROR_ALREADY_EXISTS;
+	void* mem = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+
+	CloseHandle(h); // The view keeps the mapping alive
+
+	if (mem && VirtualQuery(mem, &info, sizeof(info)))
+		size = info.RegionSize;
+
+	return mem;
+
+#else
+
+	string path = name[0] == '/' ? name : "/" + name;
+	struct stat st;
+	int fd = -1;
+
+	// The segment may be removed between the two opens, then we create it
+	for (int tries = 0; tries < 3 && fd < 0; ++tries)
+		if ((created = (fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0))
+		{
+			if (ftruncate(fd, off_t(size)))
+			{
+				close(fd);
+				shm_unlink(path.c_str());
+				return nullptr;
+			}
+		}
+		else if (errno != EEXIST || ((fd = shm_open(path.c_str(), O_RDWR, 0600)) < 0 && errno != ENOENT))
+			return nullptr;
+
+	if (fd < 0)
+		return nullptr;
+
+	// The creator sets the size right after creating the segment
+	if (!created)
+	{
+		for (int i = 0; i < 1000 && !fstat(fd, &st) && !st.st_size; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		if (fstat(fd, &st) || !st.st_size)
+		{
+			close(fd);
+			return nullptr;
+		}
+
+		size = size_t(st.st_size);
+	}
+
+	void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping keeps the segment open
+
+	return mem == MAP_FAILED ? nullptr : mem;
+
+#endif
+}
+
+/// unmap_shared() releases a mapping from map_shared(), leaving the segment
+/// itself in place for the other processes.
+
+void unmap_shared(void* mem, size_t size)
+{
+	if (!mem)
+		return;
+
+#if defined(_WIN32)
+	(void)size;
+	UnmapViewOfFile(mem);
+#else
+	munmap(mem, size);
+#endif
+}
+
+/// remove_shared() removes the named segment, once its last user is done with
+/// it. The processes still mapping it keep their mapping, and the next one to
+/// ask for the name creates a fresh segment. Windows does this by itself when
+/// the last view is unmapped.
+
+void remove_shared(const string& name)
+{
+#if defined(_WIN32)
+	(void)name;
+#else
+	shm_unlink((name[0] == '/' ? name : "/" + name).c_str());
+#endif
+}
+
+/// bind_this_thread() pins the calling thread to a CPU for the idx-th search
+/// thread. Threads go round robin over the NUMA nodes, then over the CPUs of
+/// each node, so that they are spread evenly. Memory the thread touches first
+/// is then allocated on its node. Returns the node, or -1 when the thread could
+/// not be bound.
+
+int bind_this_thread(size_t idx)
+{
+#if defined(__linux__)
+
+	std::vector<int> nodes = online_numa_nodes();
+
+	if (nodes.empty())
+		nodes.push_back(0); // No sysfs NUMA information, node0 lists all CPUs
+
+	int node = nodes[idx % nodes.size()];
+	std::vector<int> cpus = read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	cpu_set_t set;
+
+	if (cpus.empty())
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpus[(idx / nodes.size()) % cpus.size()], &set);
+
+	return sched_setaffinity(0, sizeof(set), &set) ? -1 : node;
+
+#elif defined(_WIN32)
+
+	ULONG highest;
+	ULONGLONG mask;
+
+	if (!GetNumaHighestNodeNumber(&highest))
+		return -1;
+
+	UCHAR node = UCHAR(idx % (highest + 1));
+
+	if (!GetNumaNodeProcessorMask(node, &mask) || !mask)
+		return -1;
+
+	// Pick one processor of the node
+	int cpus = 0;
+
+	for (ULONGLONG m = mask; m; m &= m - 1)
+		++cpus;
+
+	for (int n = int((idx / (highest + 1)) % cpus); n; --n)
+		mask &= mask - 1;
+
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(mask & (~mask + 1))) ? node : -1;
+
+#else
+
+	(void)idx;
+	return -1;
+
+#endif
+}
+
+/// unbind_this_thread() lets the calling thread run on all the CPUs of the
+/// process again, as the threads created by the process do by default.
+
+void unbind_this_thread()
+{
+#if defined(__linux__)
+
+	cpu_set_t set;
+
+	// The thread of main() is never bound, so it still has the default set
+	if (!sched_getaffinity(getpid(), sizeof(set), &set))
+		sched_setaffinity(0, sizeof(set), &set);
+
+#elif defined(_WIN32)
+
+	DWORD_PTR processMask, systemMask;
+
+	if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		SetThreadAffinityMask(GetCurrentThread(), processMask);
+
+#endif
+}
+
+/// numa_node_count() is the number of NUMA nodes the threads are spread over
+
+int numa_node_count()
+{
+#if defined(__linux__)
+	return std::max(int(online_numa_nodes().size()), 1);
+#elif defined(_WIN32)
+	ULONG highest;
+	return GetNumaHighestNodeNumber(&highest) ? int(highest) + 1 : 1;
+#else
+	return 1;
+#endif
 }
\ No newline at end of file
@@ -9,6 +9,16 @@
 const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void start_logger(const std::string& fname);
+bool cpu_has_fast_pext();
+bool cpu_has_avx2();
+void* alloc_large(size_t& size, bool hugePages, bool interleave, std::string& info);
+void free_large(void* mem, size_t size);
+void* map_shared(const std::string& name, size_t& size, bool& created);
+void unmap_shared(void* mem, size_t size);
+void remove_shared(const std::string& name);
+int bind_this_thread(size_t idx);
+void unbind_this_thread();
+int numa_node_count();
 
 typedef std::chrono::milliseconds::rep TimePoint; // A value in milliseconds
 
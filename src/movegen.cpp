@@ -29,7 +29,7 @@ namespace
 					continue;
 
 				// canons facing to King
-				if (pos.attacks_from<CHARIOT>(pos.square<GENERAL>(~us)) & pos.pieces(us, CANON) & from)
+				if (Pt == CANON && (pos.attacks_from<CHARIOT>(pos.square<GENERAL>(~us)) & from))
 					continue;
 			}
 
@@ -43,27 +43,34 @@ namespace
 			else
 				b = pos.attacks_from(pos.piece_on(from), from) & target;
 
+			// Moves to the screen squares of a canon facing their general are
+			// generated by generate<QUIET_CHECKS>().
 			if (Checks)
-				b &= pos.check_squares(Pt);
-
-			while (b) {
-				Move m = make_move(from, pop_lsb(&b));
-
-				bool moveExisted = false;
-				if (Checks) {
-					// check if the move already generated
-					Bitboard canonsFacingToKing = pos.attacks_from<CHARIOT>(pos.square<GENERAL>(~us)) & pos.pieces(us, CANON);
-					while (canonsFacingToKing) {
-						if (between_bb(pop_lsb(&canonsFacingToKing), pos.square<GENERAL>(~us)) & to_sq(m)) {
-							moveExisted = true;
-							break;
-						}
-					}
-				}
-				if (moveExisted) continue;
-
-				*moveList++ = m;
-			}
+				b &= pos.check_squares(Pt) & ~pos.screen_squares(~us);
+
+			for (Square to : b)
+				*moveList++ = make_move(from, to);
+		}
+
+		return moveList;
+	}
+
+	/// generate_legal() generates the legal moves of the pieces of type Pt, the
+	/// destinations being filtered by 'targets'.
+	template<PieceType Pt>
+	ExtMove* generate_legal(const Position& pos, ExtMove* moveList, const LegalTargets& targets)
+	{
+		Color us = pos.side_to_move();
+		const Square* pl = pos.squares<Pt>(us);
+
+		for (Square from = *pl; from != PT_NONE; from = *++pl)
+		{
+			Bitboard b = Pt == CANON ? (pos.attacks_from<CHARIOT>(from) & ~pos.pieces())
+									 | (pos.attacks_from<CANON>(from) & pos.pieces(~us))
+									 : pos.attacks_from(pos.piece_on(from), from) & ~pos.pieces(us);
+
+			for (Square to : targets(from, b))
+				*moveList++ = make_move(from, to);
 		}
 
 		return moveList;
@@ -86,9 +93,8 @@ namespace
 		if (Type != QUIET_CHECKS && Type != EVASIONS)
 		{
 			Square ksq = pos.square<GENERAL>(Us);
-			Bitboard b = pos.attacks_from<GENERAL>(ksq, Us) & target;
-			while (b)
-				*moveList++ = make_move(ksq, pop_lsb(&b));
+			for (Square to : pos.attacks_from<GENERAL>(ksq, Us) & target)
+				*moveList++ = make_move(ksq, to);
 		}
 
 		return moveList;
@@ -118,6 +124,37 @@ ExtMove* generate(const Position& pos, ExtMove* moveList)
 		: generate_all<BLACK, Type>(pos, moveList, target);
 }
 
+/// generate_quiets() generates the pseudo-legal non-captures of the pieces in
+/// the given batch. Together the batches give the moves of generate<QUIETS>.
+/// Returns a pointer to the end of the move list.
+
+ExtMove* generate_quiets(const Position& pos, ExtMove* moveList, QuietBatch batch)
+{
+	Color us = pos.side_to_move();
+	Bitboard target = ~pos.pieces();
+
+	switch (batch)
+	{
+	case CHARIOT_CANON_QUIETS:
+		moveList = generate_moves< CHARIOT, false>(pos, moveList, us, target);
+		return generate_moves<  CANON, false>(pos, moveList, us, target);
+
+	case HORSE_QUIETS:
+		return generate_moves<   HORSE, false>(pos, moveList, us, target);
+
+	default:
+		moveList = generate_moves< SOLDIER, false>(pos, moveList, us, target);
+		moveList = generate_moves<ELEPHANT, false>(pos, moveList, us, target);
+		moveList = generate_moves< ADVISOR, false>(pos, moveList, us, target);
+
+		Square ksq = pos.square<GENERAL>(us);
+		for (Square to : pos.attacks_from<GENERAL>(ksq, us) & target)
+			*moveList++ = make_move(ksq, to);
+
+		return moveList;
+	}
+}
+
 // Explicit template instantiations
 template ExtMove* generate<CAPTURES>(const Position&, ExtMove*);
 template ExtMove* generate<QUIETS>(const Position&, ExtMove*);
@@ -156,28 +193,19 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList)
 		}
 	}
 
-	Bitboard canonsFacingToKing = pos.attacks_from<CHARIOT>(pos.square<GENERAL>(~us)) & pos.pieces(us, CANON);
-	while (canonsFacingToKing)
+	// Quiet moves to the screen squares of a canon facing their general, by
+	// the pieces other than the canon itself and the candidates done above.
+	if (pos.screen_squares(~us))
 	{
-		Square canonFacingToKingSq = pop_lsb(&canonsFacingToKing);
-		Bitboard pieces = pos.pieces(us) ^ canonFacingToKingSq;
-		while (pieces)
-		{
-			Square from = pop_lsb(&pieces);
-			PieceType pt = type_of(pos.piece_on(from));
+		Bitboard facing = pos.attacks_from<CHARIOT>(pos.square<GENERAL>(~us)) & pos.pieces(us, CANON);
 
-			Bitboard b;
-			if (pt == CANON)
-				b = pos.attacks_from<CHARIOT>(from) & ~pos.pieces();
-			else
-				b = pos.attacks_from(pos.piece_on(from), from) & ~pos.pieces();
+		for (Square from : pos.pieces(us) & ~pos.discovered_check_candidates() & ~facing)
+		{
+			Bitboard b = type_of(pos.piece_on(from)) == CANON ? pos.attacks_from<CHARIOT>(from)
+															   : pos.attacks_from(pos.piece_on(from), from);
 
-			while (b)
-			{
-				Square to = pop_lsb(&b);
-				if (between_bb(pos.square<GENERAL>(~us), canonFacingToKingSq) & to)
-					*moveList++ = make_move(from, to);
-			}
+			for (Square to : b & pos.screen_squares(~us) & ~pos.pieces())
+				*moveList++ = make_move(from, to);
 		}
 	}
 
@@ -198,25 +226,22 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList)
 
 	// Find all the squares attacked by slider checkers. We will remove them from
 	// the king evasions in order to skip known illegal moves, which avoids any
-	// useless legality checks later on.
-	while (sliders)
-	{
-		Square checksq = pop_lsb(&sliders);
-		sliderAttacks |= LineBB[checksq][ksq] ^ checksq;
-	}
+	// useless legality checks later on. The king may still take the screen of
+	// a checking canon, so only the squares behind the king are removed then.
+	for (Square checksq : sliders)
+		sliderAttacks |= (type_of(pos.piece_on(checksq)) == CANON ? LineBB[checksq][ksq] & ~between_bb(checksq, ksq)
+																   : LineBB[checksq][ksq]) ^ checksq;
 
 	// Generate evasions for king, capture and non capture moves
-	Bitboard b = pos.attacks_from<GENERAL>(ksq, us) & ~pos.pieces(us) & ~sliderAttacks;	
-	while (b)
-		*moveList++ = make_move(ksq, pop_lsb(&b));
+	for (Square to : pos.attacks_from<GENERAL>(ksq, us) & ~pos.pieces(us) & ~sliderAttacks)
+		*moveList++ = make_move(ksq, to);
 
-	if (more_than_one(pos.checkers()))
-	{
-		Bitboard ch = pos.checkers();
-		Square first = pop_lsb(&ch), second = pop_lsb(&ch);
-		if (!aligned(first, second, pos.square<GENERAL>(us)))
-			return moveList; // Double check, only a king move can save the day
-	}
+	Bitboard canonCheckers = pos.checkers() & pos.pieces(CANON);
+
+	// Double check, only a king move can save the day, unless one of the
+	// checkers is a canon whose screen may take or block the other one.
+	if (more_than_one(pos.checkers()) && !canonCheckers)
+		return moveList;
 
 	// Generate blocking evasions or captures of the checking piece
 	Square checksq = lsb(pos.checkers());
@@ -232,41 +257,124 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList)
 			blockSq = make_square((file_of(checksq) + file_of(ksq)) / 2, rank_of(checksq));
 		target |= blockSq;
 	}
-	// Generate blocking evasions of no trad of canon
-	else if (type_of(pos.piece_on(checksq)) == CANON)
-	{
-		Bitboard trad = between_bb(checksq, ksq) & pos.pieces(us);
-		Square tradSq = pop_lsb(&trad);
-		Bitboard b = pos.attacks_from(pos.piece_on(tradSq), tradSq) & ~pos.pieces(us);
-		while (b)
-			*moveList++ = make_move(tradSq, pop_lsb(&b));
-	}
+
+	// Generate the moves of our pieces screening a canon check. Moves to the
+	// target squares are left to generate_all() below.
+	for (Square c : canonCheckers)
+		for (Square screen : between_bb(c, ksq) & pos.pieces(us))
+		{
+			Bitboard b = type_of(pos.piece_on(screen)) == CANON
+				? (pos.attacks_from<CHARIOT>(screen) & ~pos.pieces()) | (pos.attacks_from<CANON>(screen) & pos.pieces(~us))
+				: pos.attacks_from(pos.piece_on(screen), screen) & ~pos.pieces(us);
+
+			for (Square to : b & ~target)
+				*moveList++ = make_move(screen, to);
+		}
 
 	return us == WHITE ? generate_all<WHITE, EVASIONS>(pos, moveList, target)
 		: generate_all<BLACK, EVASIONS>(pos, moveList, target);
 }
 
-/// generate<LEGAL> generates all the legal moves in the given position
+LegalTargets::LegalTargets(const Position& p) : pos(p)
+{
+	Color us = pos.side_to_move();
+	Bitboard between = between_bb(pos.square<GENERAL>(us), pos.square<GENERAL>(~us)) & pos.pieces();
+
+	ksq = pos.square<GENERAL>(us);
+	special = pos.pinned_pieces(us) | ksq;
+
+	if (!more_than_one(between))
+		special |= between & pos.pieces(us);
+
+	for (Square c : pos.checkers() & pos.pieces(CANON))
+		special |= between_bb(c, ksq) & pos.pieces(us);
+
+	common = safe_squares(pos.pieces());
+}
+
+/// LegalTargets::safe_squares() returns the squares a piece other than the
+/// general may move to, 'occupied' being the board without it, so that no
+/// enemy piece attacks our general afterwards.
+
+Bitboard LegalTargets::safe_squares(Bitboard occupied) const
+{
+	Color them = ~pos.side_to_move();
+	Square theirKsq = pos.square<GENERAL>(them);
+	Bitboard safe = ~Bitboard(0);
+
+	// A checking soldier must be captured
+	for (Square s : pos.checkers() & pos.pieces(SOLDIER))
+		safe &= s;
+
+	// A horse must be captured or have its leg blocked. The leg is the point
+	// next to the horse which is also next to our general.
+	for (Square h : pos.horses_to(ksq, occupied) & pos.pieces(them))
+		safe &= (DistanceRingBB[h][0] & PseudoAttacks[CHARIOT][h] & DistanceRingBB[ksq][0]) | h;
+
+	// A chariot on an open line must be captured or blocked. A canon with no
+	// screen must not be given one, and a canon with a single screen must be
+	// captured or given a second screen.
+	for (Square c : PseudoAttacks[CHARIOT][ksq] & pos.pieces(them, CHARIOT, CANON))
+	{
+		Bitboard b = between_bb(ksq, c);
+		int screens = popcount(b & occupied);
+
+		if (type_of(pos.piece_on(c)) == CHARIOT)
+		{
+			if (!screens)
+				safe &= b | c;
+		}
+		else if (!screens)
+			safe &= ~b;
+		else if (screens == 1)
+			safe &= (b & ~occupied) | c;
+	}
+
+	// The generals may not face each other
+	if (file_of(ksq) == file_of(theirKsq) && !(between_bb(ksq, theirKsq) & occupied))
+		safe &= between_bb(ksq, theirKsq);
+
+	return safe;
+}
+
+/// LegalTargets::operator() returns the legal destinations among the pseudo
+/// legal ones 'b' of the piece on 'from'.
+
+Bitboard LegalTargets::operator()(Square from, Bitboard b) const
+{
+	if (!(special & from))
+		return b & common;
+
+	if (from != ksq)
+		return b & safe_squares(pos.pieces() ^ from);
+
+	Color them = ~pos.side_to_move();
+	Square theirKsq = pos.square<GENERAL>(them);
+	Bitboard occupied = pos.pieces() ^ ksq;
+	Bitboard result = b;
+
+	for (Square to : b)
+		if (   (pos.attackers_to(to, occupied) & pos.pieces(them))
+			|| (file_of(to) == file_of(theirKsq) && !(between_bb(to, theirKsq) & occupied)))
+			result ^= to;
+
+	return result;
+}
+
+/// generate<LEGAL> generates all the legal moves in the given position, in
+/// check or not, each piece moving only to the squares LegalTargets keeps.
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList)
 {
-	Color us = pos.side_to_move();
-	Bitboard pinned = pos.pinned_pieces(us);
-	Square ksq = pos.square<GENERAL>(us);
-	Square theirKsq = pos.square<GENERAL>(~us);
-	bool canonsFacingKing = pos.attacks_from<CHARIOT>(ksq) & pos.pieces(~us, CANON);
-	bool flyingKingCandidate = popcount(between_bb(ksq, theirKsq) & pos.pieces()) == 1;
-	ExtMove* cur = moveList;
-
-	moveList = pos.checkers() ? generate<EVASIONS>(pos, moveList)
-		: generate<NON_EVASIONS>(pos, moveList);
-
-	while (cur != moveList)
-		if ((pinned || from_sq(*cur) == ksq || canonsFacingKing || flyingKingCandidate || pos.checkers())
-			&& !pos.legal(*cur))
-			*cur = (--moveList)->move;
-		else
-			++cur;
+	LegalTargets targets(pos);
+
+	moveList = generate_legal< SOLDIER>(pos, moveList, targets);
+	moveList = generate_legal<ELEPHANT>(pos, moveList, targets);
+	moveList = generate_legal< ADVISOR>(pos, moveList, targets);
+	moveList = generate_legal<   HORSE>(pos, moveList, targets);
+	moveList = generate_legal<   CANON>(pos, moveList, targets);
+	moveList = generate_legal< CHARIOT>(pos, moveList, targets);
+	moveList = generate_legal< GENERAL>(pos, moveList, targets);
 
 	return moveList;
 }
@@ -1,6 +1,7 @@
 #ifndef MOVEGEN_H_INCLUDED
 #define MOVEGEN_H_INCLUDED
 
+#include "bitboard.h"
 #include "types.h"
 
 class Position;
@@ -32,6 +33,40 @@ inline bool operator<(const ExtMove& f, const ExtMove& s)
 template<GenType>
 ExtMove* generate(const Position& pos, ExtMove* moveList);
 
+/// QuietBatch splits the quiet moves by the type of the moving piece, in the
+/// order the MovePicker generates them: the pieces most likely to have a good
+/// quiet move come first.
+enum QuietBatch
+{
+	CHARIOT_CANON_QUIETS,
+	HORSE_QUIETS,
+	OTHER_QUIETS,
+	QUIET_BATCH_NB
+};
+
+ExtMove* generate_quiets(const Position& pos, ExtMove* moveList, QuietBatch batch);
+
+/// LegalTargets keeps, out of the pseudo-legal destinations of one of our
+/// pieces, those that do not leave our general attacked, in check or not. Most
+/// pieces share a single mask: the squares capturing or blocking each checker
+/// and off the empty lines between our general and the enemy canons. Only the
+/// pieces screening an attack on our general, that is the pinned pieces, the
+/// screens of a checking canon and a lone piece between the two generals, get
+/// a mask of their own, and the general tests each of its moves.
+class LegalTargets
+{
+public:
+	explicit LegalTargets(const Position& pos);
+	Bitboard operator()(Square from, Bitboard b) const;
+
+private:
+	Bitboard safe_squares(Bitboard occupied) const;
+
+	const Position& pos;
+	Square ksq;
+	Bitboard common, special;
+};
+
 /// The MoveList struct is a simple wrapper around generate(). It sometimes comes
 /// in handy to use this class instead of the low level generate() function.
 template<GenType T>
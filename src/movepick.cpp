@@ -1,4 +1,9 @@
 #include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "misc.h"
 #include "movepick.h"
 #include "thread.h"
 
@@ -14,6 +19,8 @@ namespace
 		QSEARCH_RECAPTURES, QRECAPTURES
 	};
 
+	bool UseAvx2 = false;
+
 	// Our insertion sort, which is guaranteed to be stable, as it should be
 	void insertion_sort(ExtMove* begin, ExtMove* end)
 	{
@@ -28,6 +35,56 @@ namespace
 		}
 	}
 
+	// score_quiets_avx2() first lays the table indices of the moves out in
+	// arrays, then sums eight history values at a time. The gathers read 32
+	// bits starting at the 16 bit entry, whose low half is the entry itself. The
+	// high half is the next entry, which exists for every entry gathered: the
+	// last ones of the tables are for a black general on I10 and for a move
+	// from a point to itself.
+	TARGET_AVX2 void score_quiets_avx2(const Position& pos, const Search::Stack* ss,
+									   ExtMove* begin, ExtMove* end)
+	{
+
+		const Thread* thisThread = pos.this_thread();
+		const HistoryValue* tables[4] = { thisThread->history[NO_PIECE] };
+		int tableCount = 1;
+		int pieceTo[MAX_MOVES + 7], fromTo[MAX_MOVES + 7];
+		int n = int(end - begin);
+		Color c = pos.side_to_move();
+
+		for (int i : { 1, 2, 4 })
+			if ((ss - i)->counterMoves)
+				tables[tableCount++] = (*(ss - i)->counterMoves)[NO_PIECE];
+
+		for (int i = 0; i < n; ++i)
+		{
+			Move m = begin[i];
+			pieceTo[i] = int(pos.moved_piece(m)) * SQUARE_NB + int(to_sq(m));
+			fromTo[i] = (int(c) * SQUARE_NB + int(from_sq(m))) * SQUARE_NB + int(to_sq(m));
+		}
+
+		for (int i = n; i < ((n + 7) & ~7); ++i) // Dummy lanes of the last group
+			pieceTo[i] = fromTo[i] = 1;
+
+		for (int i = 0; i < n; i += 8)
+		{
+			__m256i pt = _mm256_loadu_si256((const __m256i*)&pieceTo[i]);
+			__m256i ft = _mm256_loadu_si256((const __m256i*)&fromTo[i]);
+			__m256i sum = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_i32gather_epi32(
+								(const int*)thisThread->fromTo.data(), ft, 2), 16), 16);
+			alignas(32) int values[8];
+
+			for (int t = 0; t < tableCount; ++t)
+				sum = _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(
+								_mm256_i32gather_epi32((const int*)tables[t], pt, 2), 16), 16));
+
+			_mm256_store_si256((__m256i*)values, sum);
+
+			for (int j = 0; j < 8 && i + j < n; ++j)
+				begin[i + j].value = Value(values[j]);
+		}
+	}
+
 	// pick_best() finds the best move in the range (begin, end) and moves it to
 	// the front. It's faster than sorting all the moves in advance when there
 	// are few moves, e.g., the possible captures.
@@ -54,6 +111,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, Search::Stack* s)
 	stage = pos.checkers() ? EVASION : MAIN_SEARCH;
 	ttMove = ttm && pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
 	stage += (ttMove == MOVE_NONE);
+	pos.this_thread()->pickerNodes += (stage < EVASION);
 }
 
 MovePicker::MovePicker(const Position& p, Move ttm, Depth d, Square s)
@@ -110,10 +168,15 @@ void MovePicker::score<CAPTURES>()
 		- Value(200 * relative_rank(pos.side_to_move(), to_sq(m)));
 }
 
-template<>
-void MovePicker::score<QUIETS>() 
+void score_quiets(const Position& pos, const Search::Stack* ss, ExtMove* begin, ExtMove* end, bool avx2)
 {
 
+	if (avx2)
+	{
+		score_quiets_avx2(pos, ss, begin, end);
+		return;
+	}
+
 	const HistoryStats& history = pos.this_thread()->history;
 	const FromToStats& fromTo = pos.this_thread()->fromTo;
 
@@ -123,12 +186,18 @@ void MovePicker::score<QUIETS>()
 
 	Color c = pos.side_to_move();
 
-	for (auto& m : *this)
-		m.value = history[pos.moved_piece(m)][to_sq(m)]
-		+ (cm ? (*cm)[pos.moved_piece(m)][to_sq(m)] : VALUE_ZERO)
-		+ (fm ? (*fm)[pos.moved_piece(m)][to_sq(m)] : VALUE_ZERO)
-		+ (f2 ? (*f2)[pos.moved_piece(m)][to_sq(m)] : VALUE_ZERO)
-		+ fromTo.get(c, m);
+	for (ExtMove* m = begin; m < end; ++m)
+		m->value = history[pos.moved_piece(*m)][to_sq(*m)]
+		+ (cm ? (*cm)[pos.moved_piece(*m)][to_sq(*m)] : VALUE_ZERO)
+		+ (fm ? (*fm)[pos.moved_piece(*m)][to_sq(*m)] : VALUE_ZERO)
+		+ (f2 ? (*f2)[pos.moved_piece(*m)][to_sq(*m)] : VALUE_ZERO)
+		+ fromTo.get(c, *m);
+}
+
+template<>
+void MovePicker::score<QUIETS>() 
+{
+	score_quiets(pos, ss, cur, endMoves, UseAvx2);
 }
 
 template<>
@@ -147,6 +216,93 @@ void MovePicker::score<EVASIONS>()
 			m.value = history[pos.moved_piece(m)][to_sq(m)] + fromTo.get(c, m);
 }
 
+/// use_avx2_scoring() selects the AVX2 version of score_quiets() for the search,
+/// where the CPU has AVX2. The scalar version is the default, as the gathers
+/// turn out slower than the scalar loads on the CPUs we measured.
+
+void use_avx2_scoring(bool enable)
+{
+	UseAvx2 = enable && cpu_has_avx2();
+}
+
+/// scoring_bench() is a micro-benchmark of score_quiets(). The move lists are
+/// the quiet moves of all the positions two plies after the current one, with
+/// the counter move histories of the moves leading to them, so better run it
+/// after a search has filled the history tables, e.g. after "bench". Each list
+/// is scored the given number of times with the scalar code and with AVX2, and
+/// the results are checked to be the same.
+
+void scoring_bench(const Position& current, std::istream& is)
+{
+
+	int reps = 1000;
+	is >> reps;
+
+	Thread* th = Threads.main();
+	Search::Stack stack[5] = {}, *ss = stack + 4;
+	StateInfo st[3];
+	Position pos;
+	std::chrono::steady_clock::duration elapsed[2] = {};
+	uint64_t lists = 0, moves = 0, mismatches = 0;
+
+	pos.set(current.fen(), &st[0], th);
+
+	for (const auto& m1 : MoveList<LEGAL>(pos))
+	{
+		(ss - 2)->counterMoves = &th->counterMoveHistory[pos.moved_piece(m1)][to_sq(m1)];
+		pos.do_move(m1, st[1], pos.gives_check(m1));
+
+		for (const auto& m2 : MoveList<LEGAL>(pos))
+		{
+			(ss - 1)->counterMoves = &th->counterMoveHistory[pos.moved_piece(m2)][to_sq(m2)];
+			pos.do_move(m2, st[2], pos.gives_check(m2));
+
+			if (!pos.checkers())
+			{
+				ExtMove list[2][MAX_MOVES];
+				ExtMove* end = generate<QUIETS>(pos, list[0]);
+				int n = int(end - list[0]);
+
+				std::copy(list[0], end, list[1]);
+
+				for (int avx2 = 0; avx2 <= int(cpu_has_avx2()); ++avx2)
+				{
+					auto t = std::chrono::steady_clock::now();
+
+					for (int r = 0; r < reps; ++r)
+						score_quiets(pos, ss, list[avx2], list[avx2] + n, avx2);
+
+					elapsed[avx2] += std::chrono::steady_clock::now() - t;
+				}
+
+				for (int i = 0; i < n && cpu_has_avx2(); ++i)
+					mismatches += list[0][i].value != list[1][i].value;
+
+				++lists, moves += n;
+			}
+
+			pos.undo_move(m2);
+		}
+
+		pos.undo_move(m1);
+	}
+
+	auto report = [&](const char* name, std::chrono::steady_clock::duration d) {
+		double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+		std::cout << std::setw(8) << std::left << name << std::fixed << std::setprecision(1)
+				  << std::setw(8) << std::right << ns / std::max(lists * reps, uint64_t(1)) << " ns/list"
+				  << std::setw(8) << ns / std::max(moves * reps, uint64_t(1)) << " ns/move" << std::endl;
+	};
+
+	std::cout << lists << " lists of " << moves << " quiet moves, " << reps << " times each" << std::endl;
+	report("scalar", elapsed[0]);
+
+	if (cpu_has_avx2())
+		report("avx2", elapsed[1]), std::cout << "mismatches: " << mismatches << std::endl;
+	else
+		std::cout << "avx2: not supported by this CPU" << std::endl;
+}
+
 /// next_move() is the most important method of the MovePicker class. It returns
 /// a new pseudo legal move every time it is called, until there are no more moves
 /// left. It picks the move with the biggest value from a list of generated moves
@@ -166,6 +322,7 @@ Move MovePicker::next_move()
 	case CAPTURES_INIT:
 		endBadCaptures = cur = moves;
 		endMoves = generate<CAPTURES>(pos, cur);
+		pos.this_thread()->movesGenerated += endMoves - cur;
 		score<CAPTURES>();
 		++stage;
 
@@ -212,28 +369,39 @@ Move MovePicker::next_move()
 			return move;
 
 	case QUIET_INIT:
-		cur = endBadCaptures;
-		endMoves = generate<QUIETS>(pos, cur);
-		score<QUIETS>();
-		if (depth < 3 * ONE_PLY)
-		{
-			ExtMove* goodQuiet = std::partition(cur, endMoves, [](const ExtMove& m)
-			{ return m.value > VALUE_ZERO; });
-			insertion_sort(cur, goodQuiet);
-		}
-		else
-			insertion_sort(cur, endMoves);
+		cur = endMoves = endBadCaptures;
+		quietBatch = CHARIOT_CANON_QUIETS;
 		++stage;
 
 	case QUIET:
-		while (cur < endMoves)
+		while (true)
 		{
-			move = *cur++;
-			if (move != ttMove
-				&& move != ss->killers[0]
-				&& move != ss->killers[1]
-				&& move != countermove)
-				return move;
+			while (cur < endMoves)
+			{
+				move = *cur++;
+				if (move != ttMove
+					&& move != ss->killers[0]
+					&& move != ss->killers[1]
+					&& move != countermove)
+					return move;
+			}
+
+			// Generate and sort the next batch only when the search asks for
+			// more moves, often a cutoff comes before the last batches.
+			if (quietBatch == QUIET_BATCH_NB)
+				break;
+
+			endMoves = generate_quiets(pos, cur, QuietBatch(quietBatch++));
+			pos.this_thread()->movesGenerated += endMoves - cur;
+			score<QUIETS>();
+			if (depth < 3 * ONE_PLY)
+			{
+				ExtMove* goodQuiet = std::partition(cur, endMoves, [](const ExtMove& m)
+				{ return m.value > VALUE_ZERO; });
+				insertion_sort(cur, goodQuiet);
+			}
+			else
+				insertion_sort(cur, endMoves);
 		}
 		++stage;
 		cur = moves; // Point to beginning of bad captures
@@ -1,10 +1,29 @@
 #ifndef MOVEPICK_H_INCLUDED
 #define MOVEPICK_H_INCLUDED
 
+#include <algorithm>
+#include <cstring> // For std::memset
+#include <istream>
+
 #include "movegen.h"
 #include "position.h"
 #include "types.h"
 
+/// HistoryValue is a Value as stored in the history tables, in 16 bits to halve
+/// their size. Updates keep the history values within 32 times the decay
+/// divisor, at most 29952, and storing saturates anyway.
+
+struct HistoryValue 
+{
+
+	HistoryValue() = default;
+	explicit HistoryValue(int v) : value(int16_t(std::max(-32767, std::min(v, 32767)))) {}
+	operator Value() const { return Value(value); }
+
+private:
+	int16_t value;
+};
+
 /// The Stats struct stores moves statistics. According to the template parameter
 /// the class can store History and Countermoves. History records how often
 /// different moves have been successful or unsuccessful during the current search
@@ -28,8 +47,11 @@ struct Stats
 		if (abs(int(v)) >= 324)
 			return;
 
-		table[pc][to] -= table[pc][to] * abs(int(v)) / (CM ? 936 : 324);
-		table[pc][to] += T(int(v) * 32);
+		int h = table[pc][to];
+
+		h -= h * abs(int(v)) / (CM ? 936 : 324);
+		h += int(v) * 32;
+		table[pc][to] = T(h);
 	}
 
 private:
@@ -37,14 +59,15 @@ private:
 };
 
 typedef Stats<Move> MoveStats;
-typedef Stats<Value, false> HistoryStats;
-typedef Stats<Value, true> CounterMoveStats;
+typedef Stats<HistoryValue, false> HistoryStats;
+typedef Stats<HistoryValue, true> CounterMoveStats;
 typedef Stats<CounterMoveStats> CounterMoveHistoryStats;
 
 struct FromToStats 
 {
 
 	Value get(Color c, Move m) const { return table[c][from_sq(m)][to_sq(m)]; }
+	const HistoryValue* data() const { return &table[0][0][0]; }
 	void clear() { std::memset(table, 0, sizeof(table)); }
 	void update(Color c, Move m, Value v) 
 	{
@@ -54,13 +77,15 @@ struct FromToStats
 
 		Square from = from_sq(m);
 		Square to = to_sq(m);
+		int h = table[c][from][to];
 
-		table[c][from][to] -= table[c][from][to] * abs(int(v)) / 324;
-		table[c][from][to] += static_cast<Value>(static_cast<int>(v) * 32);
+		h -= h * abs(int(v)) / 324;
+		h += int(v) * 32;
+		table[c][from][to] = HistoryValue(h);
 	}
 
 private:
-	Value table[COLOR_NB][SQUARE_NB][SQUARE_NB];
+	HistoryValue table[COLOR_NB][SQUARE_NB][SQUARE_NB];
 };
 
 
@@ -72,6 +97,13 @@ private:
 /// to get a cut-off first.
 namespace Search { struct Stack; }
 
+/// score_quiets() sets the history score of the quiet moves in a list. With
+/// avx2 the table lookups of eight moves are done at once by gathers.
+
+void score_quiets(const Position& pos, const Search::Stack* ss, ExtMove* begin, ExtMove* end, bool avx2);
+void use_avx2_scoring(bool enable);
+void scoring_bench(const Position& current, std::istream& is);
+
 class MovePicker 
 {
 public:
@@ -96,7 +128,7 @@ private:
 	Move ttMove;
 	Square recaptureSquare;
 	Value threshold;
-	int stage;
+	int stage, quietBatch;
 	ExtMove *cur, *endMoves, *endBadCaptures;
 	ExtMove moves[MAX_MOVES];
 };
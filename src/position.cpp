@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cassert>
 #include <cstring> // For std::memset, std::memcmp
 #include <sstream>
 
@@ -23,30 +24,6 @@ namespace
 
 	const std::string PieceToChar(" PNBCRAK pnbcrak");
 
-	// min_attacker() is a helper function used by see() to locate the least
-	// valuable attacker for the side to move, remove the attacker we just found
-	// from the bitboards and scan for new X-ray attacks behind it.
-
-	template<int Pt>
-	PieceType min_attacker(const Bitboard* bb, Square to, Bitboard stmAttackers,
-		Bitboard& occupied, Bitboard& attackers)
-	{
-		Bitboard b = stmAttackers & bb[Pt];
-		if (!b)
-			return min_attacker<Pt + 1>(bb, to, stmAttackers, occupied, attackers);
-
-		occupied ^= b & ~(b - 1);
-		attackers |= attacks_bb<PieceType(Pt)>(to, occupied) & bb[Pt];
-		attackers &= occupied; // After X-ray that may add already processed pieces
-
-		return (PieceType)Pt;
-	}
-
-	template<>
-	PieceType min_attacker<GENERAL>(const Bitboard*, Square, Bitboard, Bitboard&, Bitboard&) {
-		return GENERAL; // No need to update bitboards: it is the last cycle
-	}
-
 	int calculateHorseDir(Square to, Square from)
 	{
 		Square dir = DIR_NONE;
@@ -100,7 +77,7 @@ void Position::init()
 	PRNG rng(1070372);
 
 	for (Piece pc : Pieces)
-		for (Square s = PT_A1; s <= PT_I8; ++s)
+		for (Square s = PT_A1; s <= PT_I10; ++s)
 			Zobrist::psq[pc][s] = rng.rand<Key>();
 
 	Zobrist::side = rng.rand<Key>();
@@ -184,13 +161,16 @@ void Position::set_check_info(StateInfo* si) const
 	si->blockersForKing[WHITE] |= horse_blockers(pieces(BLACK, HORSE), square<GENERAL>(WHITE), si->fixedPinnersForKing[WHITE]);
 	si->blockersForKing[BLACK] |= horse_blockers(pieces(WHITE, HORSE), square<GENERAL>(BLACK), si->fixedPinnersForKing[BLACK]);
 
+	si->screenSquares[WHITE] = canon_screens(pieces(BLACK, CANON), square<GENERAL>(WHITE));
+	si->screenSquares[BLACK] = canon_screens(pieces(WHITE, CANON), square<GENERAL>(BLACK));
+
 	Square ksq = square<GENERAL>(~sideToMove);
 
 	si->checkSquares[SOLDIER] = soldierSq_to(ksq, sideToMove);
 	si->checkSquares[HORSE] = horseSq_to(ksq);
 	si->checkSquares[CANON] = attacks_from<CANON>(ksq);
 	si->checkSquares[CHARIOT] = attacks_from<CHARIOT>(ksq);
-	si->checkSquares[GENERAL] = 0;
+	si->checkSquares[ELEPHANT] = si->checkSquares[ADVISOR] = si->checkSquares[GENERAL] = 0;
 }
 
 /// Position::set_state() computes the hash keys of the position, and other
@@ -201,6 +181,7 @@ void Position::set_check_info(StateInfo* si) const
 void Position::set_state(StateInfo* si) const
 {
 	si->key = si->pawnKey = si->materialKey = 0;
+	si->materialIndex = 0;
 	si->nonPawnMaterial[WHITE] = si->nonPawnMaterial[BLACK] = VALUE_ZERO;
 	si->psq = SCORE_ZERO;
 	si->checkersBB = attackers_to(square<GENERAL>(sideToMove)) & pieces(~sideToMove);
@@ -231,6 +212,11 @@ void Position::set_state(StateInfo* si) const
 
 		for (int cnt = 0; cnt < pieceCount[pc]; ++cnt)
 			si->materialKey ^= Zobrist::psq[pc][cnt];
+
+		si->materialIndex += pieceCount[pc] * Material::IndexStride[pc];
+
+		if (pieceCount[pc] > Material::MaxPieceCount[type_of(pc)] && type_of(pc) != GENERAL)
+			si->materialIndex |= Material::IndexOverflow;
 	}
 }
 
@@ -292,9 +278,8 @@ Bitboard Position::slider_blockers(Bitboard sliders, Square s, Bitboard& pinners
 	// Snipers are chariots that attack 's' when a piece is removed
 	Bitboard snipers = (PseudoAttacks[CHARIOT][s]) & sliders;
 
-	while (snipers)
+	for (Square sniperSq : snipers)
 	{
-		Square sniperSq = pop_lsb(&snipers);
 		Bitboard b = between_bb(s, sniperSq) & pieces();
 
 		if (!more_than_one(b))
@@ -362,6 +347,20 @@ Bitboard Position::horse_blockers(Bitboard sliders, Square s, Bitboard& pinners)
 	return result;
 }
 
+/// Position::canon_screens() returns the empty squares between the square 's'
+/// and the canons facing it on an open line. Any piece moving there becomes a
+/// screen, and the canon then attacks 's'.
+
+Bitboard Position::canon_screens(Bitboard canons, Square s) const
+{
+	Bitboard result;
+
+	for (Square canonSq : attacks_from<CHARIOT>(s) & canons)
+		result |= between_bb(s, canonSq);
+
+	return result;
+}
+
 /// Return a bitboard of all horse pieces which attack a given square.
 
 Bitboard Position::horses_to(Square s, Bitboard occupied) const
@@ -369,9 +368,8 @@ Bitboard Position::horses_to(Square s, Bitboard occupied) const
 	Bitboard result;
 	Bitboard horses = attacks_bb<HORSE>(s, 0) & pieces(HORSE);
 
-	while (horses)
+	for (Square horseSq : horses)
 	{
-		Square horseSq = pop_lsb(&horses);
 		int dir = calculateHorseDir(s, horseSq);
 
 		// Check if there is a blocking piece
@@ -454,61 +452,39 @@ Bitboard Position::attackers_to(Square s, Bitboard occupied) const
 		| (attacks_from<GENERAL	>(s, BLACK)		& pieces(BLACK, GENERAL));
 }
 
-/// Position::legal() tests whether a pseudo-legal move is legal
+/// Position::legal() tests whether a pseudo-legal move is legal. Canon screens
+/// and horse legs make pins hard to follow incrementally, so we simply look at
+/// the attacks on our general with the occupancy after the move.
 
 bool Position::legal(Move m) const
 {
 	Color us = sideToMove;
 	Square from = from_sq(m);
 	Square to = to_sq(m);
-	Square ksq = square<GENERAL>(us);
+	Square ksq = type_of(piece_on(from)) == GENERAL ? to : square<GENERAL>(us);
 	Square theirKsq = square<GENERAL>(~us);
+	Bitboard occupied = (pieces() ^ from) | to;
 
-	if (type_of(piece_on(from)) == GENERAL)
-	{
-		// check whether the destination square is attacked by the opponent.
-		if (attackers_to(to) & pieces(~us))
-			return false;
-		// check whether two kings face each other
-		else if (file_of(to) == file_of(theirKsq) && !(between_bb(to, theirKsq) & (pieces() ^ from | to)))
-			return false;
-		else
-			return true;
-	}
-
-	// Check if the move gives two kings facing each other
-	else if (file_of(ksq) == file_of(theirKsq) && !(between_bb(ksq, theirKsq) & (pieces() ^ from | to)))
+	// The two generals may never face each other on an open file
+	if (file_of(ksq) == file_of(theirKsq) && !(between_bb(ksq, theirKsq) & occupied))
 		return false;
 
-	// Check if move into space between the canon and king
-	Bitboard canonsFacingToKing = attacks_from<CHARIOT>(ksq) & pieces(~us, CANON);
-	while (canonsFacingToKing)
-	{
-		Square canonSq = pop_lsb(&canonsFacingToKing);
-		if (between_bb(canonSq, ksq) & to)
-			return false;
-	}
-
-	// Check if the move interupts canon check
-	Bitboard checker = checkers();
-	Square checkerSq = lsb(checker);
-	if (checker && type_of(piece_on(checkerSq)) == CANON
-		// any move that does not block the check or voids the trad shall be considered as illegal
-		&& ((((between_bb(checkerSq, ksq) | checkerSq) & to) || (between_bb(checkerSq, ksq) & from)) == false
-			// any move that only translates the trad to somewhere between the checker and King is also illegal
-			|| (aligned(checkerSq, from, ksq) && aligned(checkerSq, to, ksq))))
-		return false;
+	// When we are not in check, only a pinned piece, or a piece becoming the
+	// screen of a canon facing our general, can expose it.
+	if (   ksq != to
+		&& !checkers()
+		&& !(pinned_pieces(us) & from)
+		&& !(st->screenSquares[us] & to))
+		return true;
 
-	// Check if the move gives a horse check
-	if (fixedPinned_pieces(us) & from)
-		return false;
+	// No enemy piece, apart from the captured one, may attack our general. Only
+	// soldiers, horses, chariots and canons can reach it.
+	Bitboard them = pieces(~us) & ~SquareBB[to];
 
-	// A non-king move is legal if and only if it is not pinned or it
-	// is moving along the ray towards or away from the king.
-	if ((pinned_pieces(us) & from) && !aligned(from, to, ksq))
-		return false;
-
-	return !receives_canon_check(m);
+	return !(  (((attacks_from<SOLDIER>(ksq, us) & file_bb(ksq)) | (attacks_from<SOLDIER>(ksq, ~us) & rank_bb(ksq))) & pieces(SOLDIER) & them)
+			 | (horses_to(ksq, occupied) & them)
+			 | (attacks_bb<CHARIOT>(ksq, occupied) & pieces(CHARIOT) & them)
+			 | (attacks_bb<CANON>(ksq, occupied) & pieces(CANON) & them));
 }
 
 /// Position::pseudo_legal() takes a random move and tests whether the move is
@@ -563,69 +539,44 @@ bool Position::pseudo_legal(const Move m) const
 	return true;
 }
 
-/// Position::gives_check() tests whether a pseudo-legal move gives a check
+/// Position::gives_check() tests whether a pseudo-legal move gives a check.
+/// Chariot and canon lines are tested with the occupancy after the move, since
+/// the moving piece may open or close a line, or add or remove a canon screen.
 
 bool Position::gives_check(Move m) const
 {
 	Square from = from_sq(m);
 	Square to = to_sq(m);
+	Square ksq = square<GENERAL>(~sideToMove);
+	PieceType pt = type_of(piece_on(from));
 
-	if (gives_canon_check(m))
+	// A move along a line of their general may change the screens of a canon,
+	// its own included, so chariots and canons are looked up on the board
+	// after the move.
+	if (aligned(from, to, ksq))
 	{
-		return true;
-	}
-	// Is there a discovered check?
-	else if ((discovered_check_candidates() & from))
-	{
-		if (!aligned(from, to, square<GENERAL>(~sideToMove)))
-			return true;
-		else
-			return false;
+		Bitboard occupied = (pieces() ^ from) | to;
+		Bitboard chariots = pieces(sideToMove, CHARIOT);
+		Bitboard canons = pieces(sideToMove, CANON);
+
+		if (pt == CHARIOT)
+			chariots ^= SquareBB[from] | to;
+		else if (pt == CANON)
+			canons ^= SquareBB[from] | to;
+
+		return bool(  (pt == SOLDIER ? st->checkSquares[SOLDIER] & to : Bitboard())
+					| (attacks_bb<CHARIOT>(ksq, occupied) & chariots)
+					| (attacks_bb<CANON>(ksq, occupied) & canons));
 	}
 
 	// Is there a direct check?
-	PieceType pt = type_of(piece_on(from));
-	if (pt != CANON && st->checkSquares[pt] & to)
+	if (st->checkSquares[pt] & to)
 		return true;
 
-	return false;
-}
-
-/// Tests whether a pseudo-legal move gives a canon check
-
-bool Position::gives_canon_check(Move m) const
-{
-	Square from = from_sq(m);
-	Square to = to_sq(m);
-	Square ksq = square<GENERAL>(~sideToMove);
-
-	Bitboard occupied = byTypeBB[ALL_PIECES] ^ from | to;
-	Bitboard attackers = attacks_bb<CANON>(ksq, occupied);
-	Bitboard canons = pieces(sideToMove, CANON);
-	if (type_of(piece_on(from)) == CANON)
-		canons = canons ^ from | to;
-
-	if (!aligned(from, to, square<GENERAL>(~sideToMove)))
-		return (attackers & canons);
-
-	return false;
-}
-
-/// Tests whether a pseudo-legal move receives a canon check
-
-bool Position::receives_canon_check(Move m) const
-{
-	Square from = from_sq(m);
-	Square to = to_sq(m);
-	Square ksq = square<GENERAL>(sideToMove);
-
-	Bitboard occupied = byTypeBB[ALL_PIECES] ^ from | to;
-	Bitboard attackers = attacks_bb<CANON>(ksq, occupied);
-	Bitboard canons = pieces(~sideToMove, CANON);
-	if (type_of(piece_on(to)) == CANON)
-		canons = canons ^ to;
-
-	return attackers & canons;
+	// Is there a discovered check? The moving piece may open a chariot line,
+	// leave a canon with a single screen, free a horse leg, or become the
+	// screen of a canon facing their general.
+	return (discovered_check_candidates() & from) || (st->screenSquares[~sideToMove] & to);
 }
 
 /// Position::do_move() makes a move, and saves all information necessary
@@ -640,13 +591,14 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 	//std::cout << fen() << std::endl;
 	//std::cout << *this << std::endl;
 
-	++nodes;
+	thisThread->counters.add_node();
 	Key k = st->key ^ Zobrist::side;
 
 	// Copy some fields of the old state to our new StateInfo object except the
 	// ones which are going to be recalculated from scratch anyway and then switch
 	// our state pointer to point to the new (ready to be updated) state.
 	std::memcpy(&newSt, st, offsetof(StateInfo, key));
+	std::memset(newSt.seeCache, 0, sizeof(newSt.seeCache));
 	newSt.previous = st;
 	st = &newSt;
 
@@ -676,12 +628,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 		// Update board and piece lists
 		remove_piece(captured, capsq);
 
-		// Update material hash key and prefetch access to materialTable
+		// Update material hash key and material table index
 		k ^= Zobrist::psq[captured][capsq];
 		st->materialKey ^= Zobrist::psq[captured][pieceCount[captured]];
-#if 0
-		prefetch(thisThread->materialTable[st->materialKey]);
-#endif
+		st->materialIndex -= Material::IndexStride[captured];
 
 		// Update incremental scores
 		st->psq -= PSQT::psq[captured][capsq];
@@ -761,6 +711,7 @@ void Position::undo_move(Move m)
 void Position::do_null_move(StateInfo& newSt)
 {
 	std::memcpy(&newSt, st, sizeof(StateInfo));
+	std::memset(newSt.seeCache, 0, sizeof(newSt.seeCache));
 	newSt.previous = st;
 	st = &newSt;
 
@@ -798,11 +749,139 @@ Key Position::key_after(Move m) const
 	return k ^ Zobrist::psq[pc][to] ^ Zobrist::psq[pc][from];
 }
 
+/// Position::pawn_key_after() and material_index_after() are the pawn key and
+/// the material table index after the given move, so that the search can also
+/// prefetch the entries the evaluation of the child position will need.
+
+Key Position::pawn_key_after(Move m) const
+{
+	Square from = from_sq(m);
+	Square to = to_sq(m);
+	Piece pc = piece_on(from);
+	Piece captured = piece_on(to);
+	Key k = st->pawnKey;
+
+	if (type_of(captured) == SOLDIER)
+		k ^= Zobrist::psq[captured][to];
+
+	if (type_of(pc) == SOLDIER)
+		k ^= Zobrist::psq[pc][to] ^ Zobrist::psq[pc][from];
+
+	return k;
+}
+
+int Position::material_index_after(Move m) const
+{
+	Piece captured = piece_on(to_sq(m));
+
+	return captured ? st->materialIndex - Material::IndexStride[captured] : st->materialIndex;
+}
+
+/// Position::see() returns the static exchange evaluation of a move: the value
+/// of the material won or lost when both sides keep capturing on the destination
+/// square with their least valuable attacker, and may stop when it suits them.
+/// The value is kept in the SEE cache of the position as an exact entry.
+
+Value Position::see(Move m) const
+{
+	SeeEntry* e = see_entry(m);
+
+	if (e->move != m || e->lower != e->upper)
+	{
+		e->move = m;
+		e->lower = e->upper = see_swap(m);
+	}
+
+	return e->lower;
+}
+
+/// Position::see_swap() computes the SEE value with a swap list, without
+/// looking at the cache.
+
+Value Position::see_swap(Move m) const
+{
+	Square from = from_sq(m), to = to_sq(m);
+	PieceType nextVictim = type_of(piece_on(from));
+	Color stm = ~color_of(piece_on(from)); // First consider opponent's move
+	Value swapList[32];
+	int sl = 1;
+
+	swapList[0] = PieceValue[MG][piece_on(to)];
+
+	// Find all attackers to the destination square, with the moving piece and
+	// the captured one removed.
+	Bitboard occupied = pieces() ^ from ^ to;
+	Bitboard attackers = attackers_to(to, occupied) & occupied;
+
+	while (nextVictim != GENERAL)
+	{
+		Bitboard stmAttackers = attackers & pieces(stm);
+
+		// Don't allow pinned pieces to attack pieces except the king as long all
+		// pinners are on their original square.
+		if (!(st->pinnersForKing[stm] & ~occupied))
+			stmAttackers &= ~st->blockersForKing[stm];
+
+		if (!stmAttackers)
+			break;
+
+		// The general may only capture when the other side has no attacker left
+		PieceType pt = next_attacker(to, stmAttackers, occupied, attackers);
+
+		if (pt == GENERAL && (attackers & pieces(~stm)))
+			break;
+
+		// Add the new entry to the swap list
+		swapList[sl] = -swapList[sl - 1] + PieceValue[MG][nextVictim];
+		++sl;
+
+		nextVictim = pt;
+		stm = ~stm;
+	}
+
+	// Having built the swap list, negamax through it to find the best achievable
+	// score from the point of view of the side to move.
+	while (--sl)
+		swapList[sl - 1] = std::min(-swapList[sl], swapList[sl - 1]);
+
+	return swapList[0];
+}
+
 /// Position::see_ge (Static Exchange Evaluation Greater or Equal) tests if the
 /// SEE value of move is greater or equal to the given value. We'll use an
-/// algorithm similar to alpha-beta pruning with a null window.
+/// algorithm similar to alpha-beta pruning with a null window. Each answer is
+/// a bound on the SEE value, kept in the SEE cache of the position, so that
+/// asking again for the same move with another threshold is often answered
+/// by a comparison.
 
 bool Position::see_ge(Move m, Value v) const
+{
+	SeeEntry* e = see_entry(m);
+
+	if (e->move == m)
+	{
+		if (e->lower >= v)
+			return true;
+
+		if (e->upper < v)
+			return false;
+	}
+	else
+		e->move = m, e->lower = -VALUE_INFINITE, e->upper = VALUE_INFINITE;
+
+	bool result = see_ge_search(m, v);
+
+	assert(result == (see_swap(m) >= v));
+
+	if (result)
+		e->lower = std::max(e->lower, v);
+	else
+		e->upper = std::min(e->upper, v - 1);
+
+	return result;
+}
+
+bool Position::see_ge_search(Move m, Value v) const
 {
 	Square from = from_sq(m), to = to_sq(m);
 	PieceType nextVictim = type_of(piece_on(from));
@@ -844,7 +923,7 @@ bool Position::see_ge(Move m, Value v) const
 			return relativeStm;
 
 		// Locate and remove the next least valuable attacker
-		nextVictim = min_attacker<SOLDIER>(byTypeBB, to, stmAttackers, occupied, attackers);
+		nextVictim = next_attacker(to, stmAttackers, occupied, attackers);
 
 		if (nextVictim == GENERAL)
 			return relativeStm == bool(attackers & pieces(~stm));
@@ -861,6 +940,36 @@ bool Position::see_ge(Move m, Value v) const
 	}
 }
 
+/// Position::next_attacker() is a helper used by see() and see_ge() to locate
+/// the least valuable attacker for the side to move and remove it from the
+/// occupied squares. Taking a piece away may give a canon a screen or take it
+/// away, open a line for a chariot, or free the leg of a horse or the eye of an
+/// elephant, so the attackers of the destination square are updated too.
+
+PieceType Position::next_attacker(Square to, Bitboard stmAttackers,
+	Bitboard& occupied, Bitboard& attackers) const
+{
+	PieceType pt = SOLDIER;
+	while (!(stmAttackers & pieces(pt)))
+		++pt;
+
+	Square s = lsb(stmAttackers & pieces(pt));
+	occupied ^= s;
+
+	if (PseudoAttacks[CHARIOT][to] & s)
+		attackers = (attackers & ~pieces(CHARIOT, CANON))
+				  | (attacks_bb<CHARIOT>(to, occupied) & pieces(CHARIOT))
+				  | (attacks_bb<  CANON>(to, occupied) & pieces(CANON));
+	else
+		attackers = (attackers & ~pieces(HORSE, ELEPHANT))
+				  | (horses_to(to, occupied) & pieces(HORSE))
+				  | (attacks_bb<ELEPHANT>(to, occupied) & pieces(ELEPHANT));
+
+	attackers &= occupied;
+
+	return pt;
+}
+
 /// Position::is_draw() tests whether the position is drawn by repetition.
 /// It does not detect stalemates.
 
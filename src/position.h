@@ -7,6 +7,15 @@
 #include "bitboard.h"
 #include "types.h"
 
+/// SeeEntry keeps the bounds on the SEE value of a move that see() and see_ge()
+/// found in a position. An exact value has equal bounds.
+
+struct SeeEntry
+{
+	Move  move;
+	Value lower, upper;
+};
+
 /// StateInfo struct stores information needed to restore a Position object to
 /// its previous state when we retract a move. Whenever a move is made on the
 /// board (by calling Position::do_move), a StateInfo object must be passed.
@@ -16,6 +25,7 @@ struct StateInfo
 	// Copied when making a move
 	Key    pawnKey;
 	Key    materialKey;
+	int    materialIndex;
 	Value  nonPawnMaterial[COLOR_NB];
 
 	int    pliesFromNull;
@@ -29,7 +39,9 @@ struct StateInfo
 	Bitboard   blockersForKing[COLOR_NB];
 	Bitboard   pinnersForKing[COLOR_NB];
 	Bitboard   fixedPinnersForKing[COLOR_NB];
+	Bitboard   screenSquares[COLOR_NB];
 	Bitboard   checkSquares[PIECE_TYPE_NB];
+	SeeEntry   seeCache[4]; // Direct mapped by the move
 };
 
 // In a std::deque references to elements are unaffected upon resizing
@@ -73,6 +85,7 @@ public:
 	Bitboard pinned_pieces(Color c) const;
 	Bitboard fixedPinned_pieces(Color c) const;
 	Bitboard check_squares(PieceType pt) const;
+	Bitboard screen_squares(Color c) const;
 
 	// Properties of moves
 	bool capture(Move m) const;
@@ -96,13 +109,12 @@ public:
 	Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
 	Bitboard canon_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
 	Bitboard horse_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
+	Bitboard canon_screens(Bitboard canons, Square s) const;
 
 	// Properties of moves
 	bool legal(Move m) const;
 	bool pseudo_legal(const Move m) const;
 	bool gives_check(Move m) const;
-	bool gives_canon_check(Move m) const;
-	bool receives_canon_check(Move m) const;
 
 	// Doing and undoing moves
 	void do_move(Move m, StateInfo& st, bool givesCheck);
@@ -111,13 +123,17 @@ public:
 	void undo_null_move();
 
 	// Static Exchange Evaluation
+	Value see(Move m) const;
 	bool see_ge(Move m, Value value) const;
 
 	// Accessing hash keys
 	Key key() const;
 	Key key_after(Move m) const;
 	Key pawn_key() const;
+	Key pawn_key_after(Move m) const;
 	Key material_key() const;
+	int material_index() const;
+	int material_index_after(Move m) const;
 
 	// Other properties of the position
 	Phase game_phase() const;
@@ -126,7 +142,6 @@ public:
 	Score psq_score() const;
 	Value non_pawn_material(Color c) const;
 	Thread* this_thread() const;
-	uint64_t nodes_searched() const;
 	bool is_draw() const;
 
 private:
@@ -134,6 +149,12 @@ private:
 	void set_state(StateInfo* si) const;
 	void set_check_info(StateInfo* si) const;
 
+	// Static exchange helpers
+	SeeEntry* see_entry(Move m) const;
+	Value see_swap(Move m) const;
+	bool see_ge_search(Move m, Value value) const;
+	PieceType next_attacker(Square to, Bitboard stmAttackers, Bitboard& occupied, Bitboard& attackers) const;
+
 	// Other helpers
 	void put_piece(Piece pc, Square s);
 	void remove_piece(Piece pc, Square s);
@@ -146,7 +167,6 @@ private:
 	int pieceCount[PIECE_NB];
 	Square pieceList[PIECE_NB][16];
 	int index[SQUARE_NB];
-	uint64_t nodes;
 	int gamePly;
 	Color sideToMove;
 	Thread* thisThread;
@@ -155,6 +175,11 @@ private:
 
 extern std::ostream& operator<<(std::ostream& os, const Position& pos);
 
+inline SeeEntry* Position::see_entry(Move m) const
+{
+	return &st->seeCache[(m ^ (m >> 7)) & 3];
+}
+
 inline Color Position::side_to_move() const
 {
 	return sideToMove;
@@ -285,6 +310,11 @@ inline Bitboard Position::check_squares(PieceType pt) const
 	return st->checkSquares[pt];
 }
 
+inline Bitboard Position::screen_squares(Color c) const
+{
+	return st->screenSquares[c];
+}
+
 inline bool Position::pawn_passed(Color c, Square s) const
 {
 	return !(pieces(~c, SOLDIER) & passed_pawn_mask(c, s));
@@ -311,6 +341,11 @@ inline Key Position::material_key() const
 	return st->materialKey;
 }
 
+inline int Position::material_index() const
+{
+	return st->materialIndex;
+}
+
 inline Score Position::psq_score() const
 {
 	return st->psq;
@@ -326,11 +361,6 @@ inline int Position::game_ply() const
 	return gamePly;
 }
 
-inline uint64_t Position::nodes_searched() const
-{
-	return nodes;
-}
-
 inline bool Position::capture(Move m) const
 {
 	return !empty(to_sq(m));
@@ -131,6 +131,28 @@ namespace
 
 	EasyMoveManager EasyMove;
 	Value DrawValue[COLOR_NB];
+	bool UseQSearchTable, CheckNodes;
+
+	// PerftEntry stores the leaf count of a perft subtree. The key is saved
+	// xored with the count, so that an entry torn by two threads writing at
+	// once does not match any more.
+	struct PerftEntry
+	{
+		Key key;
+		uint64_t nodes;
+	};
+
+	// 16 MB, allocated only while perft runs and apart from the TT
+	const size_t PerftTableSize = 1 << 20;
+
+	std::vector<PerftEntry> PerftTable;
+	std::atomic<size_t> PerftIdx;
+
+	// The same position is counted separately at each depth
+	Key perft_key(Key key, Depth depth) { return key ^ (0x9E3779B97F4A7C15ULL * (depth / ONE_PLY)); }
+
+	uint64_t perft_leaves(const Position& pos);
+	void perft_split(Thread* th);
 
 	template <NodeType NT>
 	Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
@@ -140,6 +162,7 @@ namespace
 
 	Value value_to_tt(Value v, int ply);
 	Value value_from_tt(Value v, int ply);
+	void prefetch_child(const Position& pos, Move move);
 	void update_pv(Move* pv, Move move, Move* childPv);
 	void update_cm_stats(Stack* ss, Piece pc, Square s, Value bonus);
 	void update_stats(const Position& pos, Stack* ss, Move move, Move* quiets, int quietsCnt, Value bonus);
@@ -152,7 +175,7 @@ namespace
 void Search::init()
 {
 	for (int imp = 0; imp <= 1; ++imp)
-		for (int d = 1; d < 90; ++d)
+		for (int d = 1; d < 64; ++d)
 			for (int mc = 1; mc < 64; ++mc)
 			{
 				double r = log(d) * log(mc) / 2;
@@ -174,7 +197,11 @@ void Search::init()
 	}
 }
 
-/// Search::clear() resets search state to zero, to obtain reproducible results
+/// Search::clear() resets search state to zero, to obtain reproducible results.
+/// Every thread zeroes its own tables and a slice of the transposition table in
+/// the background, so that "ucinewgame" returns at once, even during a search,
+/// after which the tasks run. The next search waits for them in
+/// ThreadPool::start_thinking().
 
 void Search::clear() 
 {
@@ -182,45 +209,52 @@ void Search::clear()
 	TT.clear();
 
 	for (Thread* th : Threads)
-	{
-		th->history.clear();
-		th->counterMoves.clear();
-		th->fromTo.clear();
-		th->counterMoveHistory.clear();
-	}
-
-	Threads.main()->previousScore = VALUE_INFINITE;
+		th->run_task([th] {
+
+			th->history.clear();
+			th->counterMoves.clear();
+			th->fromTo.clear();
+			th->counterMoveHistory.clear();
+			th->qsTable.clear();
+			th->evalCache.clear();
+			th->pickerNodes = th->movesGenerated = th->ttProbes = th->ttHits = 0;
+
+			if (th == Threads.main())
+				Threads.main()->previousScore = VALUE_INFINITE;
+		});
 }
 
 /// Search::perft() is our utility to verify move generation. All the leaf nodes
-/// up to the given depth are generated and counted, and the sum is returned.
+/// up to the given depth are counted, and the sum is returned. The counts of
+/// the inner nodes are kept in PerftTable, shared by all the threads.
 
-template<bool Root>
 uint64_t Search::perft(Position& pos, Depth depth) {
 
+	if (depth <= ONE_PLY)
+		return perft_leaves(pos);
+
+	Key key = perft_key(pos.key(), depth);
+	PerftEntry* e = PerftTable.empty() ? nullptr : &PerftTable[key & (PerftTable.size() - 1)];
+
+	if (e && (e->key ^ e->nodes) == key)
+		return e->nodes;
+
 	StateInfo st;
-	uint64_t cnt, nodes = 0;
-	const bool leaf = (depth == 2 * ONE_PLY);
+	uint64_t nodes = 0;
 
 	for (const auto& m : MoveList<LEGAL>(pos))
 	{
-		if (Root && depth <= ONE_PLY)
-			cnt = 1, nodes++;
-		else
-		{
-			pos.do_move(m, st, pos.gives_check(m));
-			cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
-			nodes += cnt;
-			pos.undo_move(m);
-		}		
-		if (Root)
-			sync_cout << UCI::move(m) << ": " << cnt << sync_endl;		
+		pos.do_move(m, st, pos.gives_check(m));
+		nodes += perft(pos, depth - ONE_PLY);
+		pos.undo_move(m);
 	}
+
+	if (e)
+		e->key = key ^ nodes, e->nodes = nodes;
+
 	return nodes;
 }
 
-template uint64_t Search::perft<true>(Position&, Depth);
-
 
 
 // MainThread::search() is called by the main thread when the program receives
@@ -228,9 +262,43 @@ template uint64_t Search::perft<true>(Position&, Depth);
 
 void MainThread::search()
 {
+	// Perft splits the root moves among all the threads, which share a table
+	// of subtree counts.
+	if (Limits.perft)
+	{
+		PerftTable.assign(PerftTableSize, PerftEntry());
+		PerftIdx = 0;
+
+		for (Thread* th : Threads)
+			if (th != this)
+				th->start_searching();
+
+		perft_split(this);
+
+		for (Thread* th : Threads)
+			if (th != this)
+				th->wait_for_search_over();
+
+		std::vector<PerftEntry>().swap(PerftTable);
+
+		sync_cout << "\nNodes searched: " << Threads.perft_nodes() << "\n" << sync_endl;
+		return;
+	}
+
 	Color us = rootPos.side_to_move();
 	Time.init(Limits, us, rootPos.game_ply());
 
+	UseQSearchTable = Options["QSearch Hash"];
+
+	// The timer stops the search on time, the threads only check node limits
+	CheckNodes = Limits.nodes || Limits.npmsec;
+
+	if (Limits.movetime)
+		Threads.timer->arm(Limits.startTime + Limits.movetime);
+
+	else if (Limits.use_time_management() && !Limits.npmsec)
+		Threads.timer->arm(Limits.startTime + Time.maximum() - 10);
+
 	int contempt = Options["Contempt"] * SoldierValueEg / 100; // From centipawns
 	DrawValue[us] = VALUE_DRAW - Value(contempt);
 	DrawValue[~us] = VALUE_DRAW + Value(contempt);
@@ -273,7 +341,9 @@ void MainThread::search()
 	// Wait until all threads have finished
 	for (Thread* th : Threads)
 		if (th != this)
-			th->wait_for_search_finished();
+			th->wait_for_search_over();
+
+	timerFired = Threads.timer->disarm();
 
 	// Check if there are threads with a better score than main thread
 	Thread* bestThread = this;
@@ -314,6 +384,12 @@ void Thread::search()
 	Move easyMove = MOVE_NONE;
 	MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
 
+	if (Limits.perft)
+	{
+		perft_split(this);
+		return;
+	}
+
 	std::memset(ss - 5, 0, 8 * sizeof(Stack));
 
 	bestValue = delta = alpha = -VALUE_INFINITE;
@@ -535,24 +611,27 @@ namespace
 
 		// Step 1. Initialize node
 		Thread* thisThread = pos.this_thread();
-		inCheck = pos.checkers();
+		inCheck = bool(pos.checkers());
 		moveCount = quietCount = ss->moveCount = 0;
 		ss->history = VALUE_ZERO;
 		bestValue = -VALUE_INFINITE;
 		ss->ply = (ss - 1)->ply + 1;
 
-		// Check for the available remaining time
-		if (thisThread->resetCalls.load(std::memory_order_relaxed))
-		{
-			thisThread->resetCalls = false;
-			thisThread->callsCnt = 0;
-		}
-		if (++thisThread->callsCnt > 4096)
+		// Check for the node limits, time limits are up to the timer thread
+		if (CheckNodes)
 		{
-			for (Thread* th : Threads)
-				th->resetCalls = true;
+			if (thisThread->resetCalls.load(std::memory_order_relaxed))
+			{
+				thisThread->resetCalls = false;
+				thisThread->callsCnt = 0;
+			}
+			if (++thisThread->callsCnt > 4096)
+			{
+				for (Thread* th : Threads)
+					th->resetCalls = true;
 
-			check_time();
+				check_time();
+			}
 		}
 
 		// Used to send selDepth info to GUI
@@ -563,7 +642,7 @@ namespace
 		{
 			// Step 2. Check for aborted search and immediate draw
 			if (Signals.stop.load(std::memory_order_relaxed) || pos.is_draw() || ss->ply >= MAX_PLY)
-				return ss->ply >= MAX_PLY && !inCheck ? evaluate(pos)
+				return ss->ply >= MAX_PLY && !inCheck ? thisThread->evalCache.evaluate(pos)
 				: DrawValue[pos.side_to_move()];
 
 			// Step 3. Mate distance pruning. Even if we mate at the next move our score
@@ -591,6 +670,7 @@ namespace
 		excludedMove = ss->excludedMove;
 		posKey = pos.key() ^ Key(excludedMove);
 		tte = TT.probe(posKey, ttHit);
+		thisThread->ttProbes++, thisThread->ttHits += ttHit;
 		ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
 		ttMove = rootNode ? thisThread->rootMoves[thisThread->PVIdx].pv[0]
 			: ttHit ? tte->move() : MOVE_NONE;
@@ -635,7 +715,7 @@ namespace
 		{
 			// Never assume anything on values stored in TT
 			if ((ss->staticEval = eval = tte->eval()) == VALUE_NONE)
-				eval = ss->staticEval = evaluate(pos);
+				eval = ss->staticEval = thisThread->evalCache.evaluate(pos);
 
 			// Can ttValue be used as a better position evaluation?
 			if (ttValue != VALUE_NONE)
@@ -645,7 +725,7 @@ namespace
 		else
 		{
 			eval = ss->staticEval =
-				(ss - 1)->currentMove != MOVE_NULL ? evaluate(pos)
+				(ss - 1)->currentMove != MOVE_NULL ? thisThread->evalCache.evaluate(pos)
 				: -(ss - 1)->staticEval + 2 * Eval::Tempo;
 
 			tte->save(posKey, VALUE_NONE, BOUND_NONE, DEPTH_NONE, MOVE_NONE,
@@ -813,10 +893,7 @@ namespace
 			capture = pos.capture(move);
 			moved_piece = pos.moved_piece(move);
 
-			givesCheck = type_of(move) == NORMAL && !pos.discovered_check_candidates()
-				? (pos.check_squares(type_of(pos.piece_on(from_sq(move)))) & to_sq(move))					
-					&& (type_of(pos.piece_on(from_sq(move))) != CANON || pos.gives_canon_check(move))
-				: pos.gives_check(move);
+			givesCheck = pos.gives_check(move);
 
 			moveCountPruning = depth < 16 * ONE_PLY
 				&& moveCount >= FutilityMoveCounts[improving][depth / ONE_PLY];
@@ -892,7 +969,7 @@ namespace
 			}
 
 			// Speculative prefetch as early as possible
-			prefetch(TT.first_entry(pos.key_after(move)));
+			prefetch_child(pos, move);
 
 			// Check for legality just before making the move
 			if (!rootNode && !pos.legal(move))
@@ -1141,6 +1218,7 @@ namespace
 		Key posKey;
 		Move ttMove, move, bestMove;
 		Value bestValue, value, ttValue, futilityValue, futilityBase, oldAlpha;
+		Thread* thisThread = pos.this_thread();
 		bool ttHit, givesCheck, evasionPrunable;
 		Depth ttDepth;
 
@@ -1156,7 +1234,7 @@ namespace
 
 		// Check for an instant draw or if the maximum ply has been reached
 		if (pos.is_draw() || ss->ply >= MAX_PLY)
-			return ss->ply >= MAX_PLY && !InCheck ? evaluate(pos)
+			return ss->ply >= MAX_PLY && !InCheck ? thisThread->evalCache.evaluate(pos)
 			: DrawValue[pos.side_to_move()];
 
 		assert(0 <= ss->ply && ss->ply < MAX_PLY);
@@ -1167,9 +1245,15 @@ namespace
 		ttDepth = InCheck || depth >= DEPTH_QS_CHECKS ? DEPTH_QS_CHECKS
 			: DEPTH_QS_NO_CHECKS;
 
-		// Transposition table lookup
+		// Transposition table lookup. A miss goes to the qsearch table of the
+		// thread if any, so that qsearch doesn't take new slots of the main one.
 		posKey = pos.key();
 		tte = TT.probe(posKey, ttHit);
+		thisThread->ttProbes++, thisThread->ttHits += ttHit;
+
+		if (!ttHit && UseQSearchTable)
+			tte = thisThread->qsTable.probe(posKey, ttHit);
+
 		ttMove = ttHit ? tte->move() : MOVE_NONE;
 		ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
 
@@ -1193,7 +1277,7 @@ namespace
 			{
 				// Never assume anything on values stored in TT
 				if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
-					ss->staticEval = bestValue = evaluate(pos);
+					ss->staticEval = bestValue = thisThread->evalCache.evaluate(pos);
 
 				// Can ttValue be used as a better position evaluation?
 				if (ttValue != VALUE_NONE)
@@ -1202,7 +1286,7 @@ namespace
 			}
 			else
 				ss->staticEval = bestValue =
-				(ss - 1)->currentMove != MOVE_NULL ? evaluate(pos)
+				(ss - 1)->currentMove != MOVE_NULL ? thisThread->evalCache.evaluate(pos)
 				: -(ss - 1)->staticEval + 2 * Eval::Tempo;
 
 			// Stand pat. Return immediately if static value is at least beta
@@ -1232,10 +1316,7 @@ namespace
 		{
 			assert(is_ok(move));
 
-			givesCheck = type_of(move) == NORMAL && !pos.discovered_check_candidates()
-				? (pos.check_squares(type_of(pos.piece_on(from_sq(move)))) & to_sq(move)) 
-					&& (type_of(pos.piece_on(from_sq(move))) != CANON || pos.gives_canon_check(move))					
-				: pos.gives_check(move);
+			givesCheck = pos.gives_check(move);
 
 			// Futility pruning
 			if (!InCheck
@@ -1252,10 +1333,17 @@ namespace
 					continue;
 				}
 
-				if (futilityBase <= alpha && !pos.see_ge(move, VALUE_ZERO + 1))
+				// The exact SEE value bounds what the capture can win, so a
+				// capture winning too little to reach alpha is pruned too.
+				if (futilityBase <= alpha)
 				{
-					bestValue = std::max(bestValue, futilityBase);
-					continue;
+					Value seeValue = pos.see(move);
+
+					if (seeValue <= VALUE_ZERO || futilityBase + seeValue <= alpha)
+					{
+						bestValue = std::max(bestValue, futilityBase + std::max(seeValue, VALUE_ZERO));
+						continue;
+					}
 				}
 			}
 
@@ -1270,7 +1358,7 @@ namespace
 				continue;
 
 			// Speculative prefetch as early as possible
-			prefetch(TT.first_entry(pos.key_after(move)));
+			prefetch_child(pos, move);
 
 			// Check for legality just before making the move
 			if (!pos.legal(move))
@@ -1351,6 +1439,28 @@ namespace
 			: v <= VALUE_MATED_IN_MAX_PLY ? v + Value(ply) : v;
 	}
 
+	// prefetch_child() starts loading the cache lines that the child position
+	// after the move is going to probe: its TT cluster and, for its static
+	// evaluation, its pawn, material and evaluation cache entries.
+
+	void prefetch_child(const Position& pos, Move move)
+	{
+
+		Thread* thisThread = pos.this_thread();
+		Key key = pos.key_after(move);
+		const Material::Entry* me = Material::entry(pos.material_index_after(move));
+		const void* ce = thisThread->evalCache.entry(key);
+
+		prefetch(TT.first_entry(key));
+		prefetch(thisThread->pawnsTable[pos.pawn_key_after(move)]);
+
+		if (me)
+			prefetch(const_cast<Material::Entry*>(me));
+
+		if (ce)
+			prefetch(const_cast<void*>(ce));
+	}
+
 	// update_pv() adds current move and appends child pv[]
 
 	void update_pv(Move* pv, Move move, Move* childPv) 
@@ -1448,31 +1558,68 @@ namespace
 		return best;
 	}
 
-	// check_time() is used to print debug info and, more importantly, to detect
-	// when we are out of available time and thus stop the search.
+	// check_time() is called by the search threads to stop the search once the
+	// node limit is reached, or in nodes as time mode once the nodes budget is
+	// spent. Other time limits are watched by the timer thread.
 
 	void check_time() 
 	{
 
-		static TimePoint lastInfoTime = now();
-
-		int elapsed = Time.elapsed();
-		TimePoint tick = Limits.startTime + elapsed;
-
-		if (tick - lastInfoTime >= 1000)
-		{
-			lastInfoTime = tick;			
-		}
-
 		// An engine may not stop pondering until told so by the GUI
 		if (Limits.ponder)
 			return;
 
-		if ((Limits.use_time_management() && elapsed > Time.maximum() - 10)
-			|| (Limits.movetime && elapsed >= Limits.movetime)
+		if ((Limits.use_time_management() && Time.elapsed() > Time.maximum() - 10)
 			|| (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
 			Signals.stop = true;
 	}
+
+	// perft_leaves() counts the legal moves of a position without building a
+	// move list, with the same LegalTargets as generate<LEGAL>.
+
+	uint64_t perft_leaves(const Position& pos)
+	{
+		LegalTargets targets(pos);
+		Color us = pos.side_to_move();
+		uint64_t cnt = 0;
+
+		for (Square from : pos.pieces(us))
+		{
+			Bitboard b = type_of(pos.piece_on(from)) == CANON
+				? (pos.attacks_from<CHARIOT>(from) & ~pos.pieces()) | (pos.attacks_from<CANON>(from) & pos.pieces(~us))
+				: pos.attacks_from(pos.piece_on(from), from) & ~pos.pieces(us);
+
+			cnt += popcount(targets(from, b));
+		}
+
+		return cnt;
+	}
+
+	// perft_split() is run by all the threads. The root moves are handed out
+	// one at a time, so that a thread done with a small subtree takes the next.
+
+	void perft_split(Thread* th)
+	{
+		StateInfo st;
+		Position& pos = th->rootPos;
+		Depth depth = Limits.perft * ONE_PLY;
+
+		for (size_t i; (i = PerftIdx++) < th->rootMoves.size(); )
+		{
+			Move m = th->rootMoves[i].pv[0];
+			uint64_t cnt = 1;
+
+			if (depth > ONE_PLY)
+			{
+				pos.do_move(m, st, pos.gives_check(m));
+				cnt = Search::perft(pos, depth - ONE_PLY);
+				pos.undo_move(m);
+			}
+
+			th->perftNodes += cnt;
+			sync_cout << UCI::move(m) << ": " << cnt << sync_endl;
+		}
+	}
 }
 
 /// UCI::pv() formats PV information according to the UCI protocol. UCI requires
@@ -61,16 +61,16 @@ struct LimitsType
 	LimitsType() 
 	{ // Init explicitly due to broken value-initialization of non POD in MSVC
 		nodes = time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] =
-			npmsec = movestogo = depth = movetime = mate = infinite = ponder = 0;
+			npmsec = movestogo = depth = movetime = mate = perft = infinite = ponder = 0;
 	}
 
 	bool use_time_management() const 
 	{
-		return !(mate | movetime | depth | nodes | infinite);
+		return !(mate | movetime | depth | nodes | perft | infinite);
 	}
 
 	std::vector<Move> searchmoves;
-	int time[COLOR_NB], inc[COLOR_NB], npmsec, movestogo, depth, movetime, mate, infinite, ponder;
+	int time[COLOR_NB], inc[COLOR_NB], npmsec, movestogo, depth, movetime, mate, perft, infinite, ponder;
 	int64_t nodes;
 	TimePoint startTime;
 };
@@ -88,7 +88,7 @@ extern LimitsType Limits;
 
 void init();
 void clear();
-template<bool Root = true> uint64_t perft(Position& pos, Depth depth);
+uint64_t perft(Position& pos, Depth depth);
 
 }
 
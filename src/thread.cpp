@@ -1,5 +1,6 @@
 #include <algorithm> // For std::count
 #include <cassert>
+#include <iostream>
 
 #include "movegen.h"
 #include "search.h"
@@ -13,9 +14,9 @@ ThreadPool Threads; // Global object
 
 Thread::Thread()
 {
-	resetCalls = exit = false;
+	resetCalls = exit = inSearch = false;
 	maxPly = callsCnt = 0;
-	tbHits = 0;
+	counters.nodes = counters.tbHits = perftNodes = pickerNodes = movesGenerated = ttProbes = ttHits = 0;
 	history.clear();
 	counterMoves.clear();
 	idx = Threads.size(); // Start from 0
@@ -47,6 +48,15 @@ void Thread::wait_for_search_finished() {
 	sleepCondition.wait(lk, [&] { return !searching; });
 }
 
+/// Thread::wait_for_search_over() waits until the search of the thread is over,
+/// but not for the tasks queued behind it, which are run meanwhile.
+
+void Thread::wait_for_search_over() {
+
+	std::unique_lock<Mutex> lk(mutex);
+	sleepCondition.wait(lk, [&] { return !inSearch; });
+}
+
 /// Thread::wait() waits on sleep condition until condition is true
 
 void Thread::wait(std::atomic_bool& condition) {
@@ -63,21 +73,48 @@ void Thread::start_searching(bool resume)
 	std::unique_lock<Mutex> lk(mutex);
 
 	if (!resume)
-		searching = true;
+		searching = inSearch = true;
 
 	sleepCondition.notify_one();
 }
 
+/// Thread::search_running() tells whether the thread is busy with a search, as
+/// opposed to being idle or running tasks.
+
+bool Thread::search_running()
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+	return inSearch;
+}
+
+/// Thread::run_task() hands the thread a function to run instead of a search
+/// and returns immediately. When the thread is searching, the task is queued
+/// and runs once the search is over, so that the caller doesn't wait for it.
+/// Waiting for the tasks to finish works as for a search.
+
+void Thread::run_task(std::function<void()> f)
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+	tasks.push_back(std::move(f));
+	searching = true;
+	sleepCondition.notify_one();
+}
+
 /// Thread::idle_loop() is where the thread is parked when it has no work to do
 
 void Thread::idle_loop() 
 {
 
+	if (Threads.bindThreads)
+		bind_this_thread(idx);
+
 	while (!exit)
 	{
 		std::unique_lock<Mutex> lk(mutex);
 
-		searching = false;
+		searching = !tasks.empty(); // Tasks queued during a search run now
 
 		while (!searching && !exit)
 		{
@@ -85,22 +122,116 @@ void Thread::idle_loop()
 			sleepCondition.wait(lk);
 		}
 
+		std::function<void()> task;
+
+		if (!tasks.empty())
+			task = std::move(tasks.front()), tasks.pop_front();
+
 		lk.unlock();
 
-		if (!exit)
+		if (task) // Run even when exiting, someone may count on it
+			task();
+		else if (!exit)
+		{
 			search();
+
+			lk.lock();
+			inSearch = false;
+			sleepCondition.notify_all(); // Wake up wait_for_search_over()
+		}
+	}
+}
+
+/// TimerThread constructor launches the timer, which waits to be armed
+
+TimerThread::TimerThread()
+{
+	exit = armed = false;
+	deadline = fired = 0;
+	nativeThread = std::thread(&TimerThread::idle_loop, this);
+}
+
+/// TimerThread destructor wakes up the timer and waits for its termination
+
+TimerThread::~TimerThread()
+{
+
+	mutex.lock();
+	exit = true;
+	sleepCondition.notify_one();
+	mutex.unlock();
+	nativeThread.join();
+}
+
+/// TimerThread::arm() sets the time at which the current search must stop
+
+void TimerThread::arm(TimePoint stopTime)
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+	armed = true;
+	deadline = stopTime;
+	fired = 0;
+	sleepCondition.notify_one();
+}
+
+/// TimerThread::disarm() is called when the search is over, to not stop the
+/// next one. It returns the time the timer stopped the search, 0 if it did not.
+
+TimePoint TimerThread::disarm()
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+	TimePoint t = fired;
+	armed = false;
+	fired = 0;
+	return t;
+}
+
+/// TimerThread::wake_up() has the timer check the limits again, as done when
+/// the GUI sends "ponderhit".
+
+void TimerThread::wake_up()
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+	sleepCondition.notify_one();
+}
+
+/// TimerThread::idle_loop() sleeps until the deadline or a change of the state
+/// of the timer. A search past its deadline is stopped unless pondering, in
+/// which case the next wake up is for "ponderhit".
+
+void TimerThread::idle_loop()
+{
+
+	std::unique_lock<Mutex> lk(mutex);
+
+	while (!exit)
+	{
+		if (!armed || (now() >= deadline && Search::Limits.ponder))
+			sleepCondition.wait(lk);
+
+		else if (now() < deadline)
+			sleepCondition.wait_until(lk, std::chrono::steady_clock::time_point(
+												 std::chrono::milliseconds(deadline)));
+		else
+		{
+			Search::Signals.stop = true;
+			fired = now();
+			armed = false;
+		}
 	}
 }
 
 /// ThreadPool::init() creates and launches requested threads that will go
 /// immediately to sleep. We cannot use a constructor because Threads is a
-/// static object and we need a fully initialized engine at this point due to
-/// allocation of Endgames in the Thread constructor.
+/// static object and we need a fully initialized engine at this point.
 
 void ThreadPool::init() 
 {
 
-	push_back(new MainThread);
+	timer = new TimerThread;
 	read_uci_options();
 }
 
@@ -111,26 +242,114 @@ void ThreadPool::init()
 void ThreadPool::exit() 
 {
 
+	delete timer;
+
 	while (size())
 		delete back(), pop_back();
 }
 
 /// ThreadPool::read_uci_options() updates internal threads parameters from the
 /// corresponding UCI options and creates/destroys threads to match requested
-/// number. Thread objects are dynamically allocated.
+/// number. Thread objects are dynamically allocated. When binding is switched
+/// on or off the helper threads are created again, as a thread is bound and
+/// its tables allocated at its creation. The main thread is only bound or
+/// unbound in place, because the positions of the UCI loop point to it.
+///
+/// During a search the threads can not be created, deleted or bound again, so
+/// a change of "Threads" or "Bind Threads" is left to the next "go", and the
+/// tables are resized by tasks queued behind the search. We never wait then,
+/// as the UCI loop must stay free to read "stop".
 
 void ThreadPool::read_uci_options() 
 {
 
 	size_t requested = Options["Threads"];
+	size_t cacheSize = Options["Eval Cache"];
+	bool qsearchHash = Options["QSearch Hash"];
+	bool bind = Options["Bind Threads"];
+	bool running = searching();
 
 	assert(requested > 0);
 
+	if (running && (requested != size() || bind != bindThreads))
+	{
+		if (!threadsPending)
+			sync_cout << "info string Threads and Bind Threads apply from the next search" << sync_endl;
+
+		threadsPending = true;
+	}
+
+	if (running)
+	{
+		for (Thread* th : *this)
+			th->run_task([th, cacheSize, qsearchHash] {
+				th->evalCache.resize(cacheSize);
+				th->qsTable.set_enabled(qsearchHash);
+			});
+
+		return;
+	}
+
+	threadsPending = false;
+
+	if (bind != bindThreads)
+	{
+		wait_for_idle();
+		bindThreads = bind;
+
+		while (size() > 1)
+			delete back(), pop_back();
+
+		if (!empty())
+			main()->run_task([bind] { bind ? void(bind_this_thread(0)) : unbind_this_thread(); });
+	}
+
+	if (empty())
+		push_back(create_thread<MainThread>());
+
 	while (size() < requested)
-		push_back(new Thread);
+		push_back(create_thread<Thread>());
 
 	while (size() > requested)
 		delete back(), pop_back();
+
+	// Each thread sizes its own tables, so that they are first touched on its node
+	for (Thread* th : *this)
+		th->run_task([th, cacheSize, qsearchHash] {
+			th->evalCache.resize(cacheSize);
+			th->qsTable.set_enabled(qsearchHash);
+		});
+
+	wait_for_idle();
+}
+
+/// ThreadPool::create_thread() allocates the next thread of the pool. With
+/// binding, the object is built by a helper thread already bound like the new
+/// one will be, so that its tables are first touched, hence allocated, on the
+/// NUMA node where it is going to run.
+
+template<typename T>
+T* ThreadPool::create_thread()
+{
+
+	if (!bindThreads)
+		return new T;
+
+	T* th = nullptr;
+
+	std::thread([&th, this] { bind_this_thread(size()); th = new T; }).join();
+
+	return th;
+}
+
+/// ThreadPool::wait_for_idle() waits until all the threads are done with their
+/// search or task, like the background clearing started by Search::clear().
+
+void ThreadPool::wait_for_idle()
+{
+
+	for (Thread* th : *this)
+		th->wait_for_search_finished();
 }
 
 /// ThreadPool::nodes_searched() returns the number of nodes searched
@@ -140,7 +359,7 @@ uint64_t ThreadPool::nodes_searched() const
 
 	uint64_t nodes = 0;
 	for (Thread* th : *this)
-		nodes += th->rootPos.nodes_searched();
+		nodes += th->counters.nodes.load(std::memory_order_relaxed);
 	return nodes;
 }
 
@@ -151,17 +370,86 @@ uint64_t ThreadPool::tb_hits() const
 
 	uint64_t hits = 0;
 	for (Thread* th : *this)
-		hits += th->tbHits;
+		hits += th->counters.tbHits.load(std::memory_order_relaxed);
+	return hits;
+}
+
+/// ThreadPool::perft_nodes() returns the number of perft leaves counted
+
+uint64_t ThreadPool::perft_nodes() const 
+{
+
+	uint64_t nodes = 0;
+	for (Thread* th : *this)
+		nodes += th->perftNodes;
+	return nodes;
+}
+
+/// ThreadPool::eval_cache_probes() and eval_cache_hits() sum the counters of
+/// the evaluation caches since the last Search::clear()
+
+uint64_t ThreadPool::eval_cache_probes() const
+{
+
+	uint64_t probes = 0;
+	for (Thread* th : *this)
+		probes += th->evalCache.probes;
+	return probes;
+}
+
+uint64_t ThreadPool::eval_cache_hits() const
+{
+
+	uint64_t hits = 0;
+	for (Thread* th : *this)
+		hits += th->evalCache.hits;
 	return hits;
 }
 
+/// ThreadPool::tt_probes() and tt_hits() sum the main transposition table
+/// lookups of search() and qsearch() since the last Search::clear()
+
+uint64_t ThreadPool::tt_probes() const
+{
+
+	uint64_t probes = 0;
+	for (Thread* th : *this)
+		probes += th->ttProbes;
+	return probes;
+}
+
+uint64_t ThreadPool::tt_hits() const
+{
+
+	uint64_t hits = 0;
+	for (Thread* th : *this)
+		hits += th->ttHits;
+	return hits;
+}
+
+/// ThreadPool::moves_generated_per_node() is the average number of moves the
+/// MovePicker generated at the main search nodes not in check, since the last
+/// Search::clear()
+
+double ThreadPool::moves_generated_per_node() const
+{
+
+	uint64_t nodes = 0, moves = 0;
+	for (Thread* th : *this)
+		nodes += th->pickerNodes, moves += th->movesGenerated;
+	return double(moves) / std::max(nodes, uint64_t(1));
+}
+
 /// ThreadPool::start_thinking() wakes up the main thread sleeping in idle_loop()
 /// and starts a new search, then returns immediately.
 
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
 	const Search::LimitsType& limits)
 {
-	main()->wait_for_search_finished();
+	wait_for_idle();
+
+	if (threadsPending)
+		read_uci_options();
 
 	Search::Signals.stopOnPonderhit = Search::Signals.stop = false;
 	Search::Limits = limits;
@@ -179,18 +467,19 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
 	if (states.get())
 		setupStates = std::move(states); // Ownership transfer, states is now empty
 
-	StateInfo tmp = setupStates->back();
-
+	// Every thread gets its own copy of the root state, as the search writes to
+	// the state of a position, e.g. the SEE cache. The copy restores st->previous,
+	// cleared by Position::set(), to reach the earlier states of the game.
 	for (Thread* th : Threads)
 	{
 		th->maxPly = 0;
-		th->tbHits = 0;
+		th->counters.nodes = th->counters.tbHits = th->perftNodes = 0;
 		th->rootDepth = DEPTH_ZERO;
 		th->rootMoves = rootMoves;
-		th->rootPos.set(pos.fen(), &setupStates->back(), th);
+		th->rootPos.set(pos.fen(), &th->rootState, th);
+		th->rootState = setupStates->back();
 	}
 
-	setupStates->back() = tmp; // Restore st->previous, cleared by Position::set()
-
+	main()->timerFired = 0;
 	main()->start_searching();
 }
\ No newline at end of file
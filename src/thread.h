@@ -4,28 +4,50 @@
 #include <atomic>
 #include <bitset>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
+#include "misc.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32.h"
+#include "tt.h"
+
+/// Counters holds the statistics of a thread that the other threads sum up.
+/// A full cache line of padding on each side keeps the updates by the owner off
+/// the lines of the Thread fields around it, which other threads read too,
+/// however the Thread is aligned: new only guarantees 16 bytes.
+
+struct Counters
+{
+	static const int CacheLineSize = 64;
+
+	void add_node() { nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+	char padding0[CacheLineSize];
+	std::atomic<uint64_t> nodes, tbHits;
+	char padding1[CacheLineSize];
+};
 
 /// Thread struct keeps together all the thread-related stuff. We also use
-/// per-thread pawn and material hash tables so that once we get a pointer to an
-/// entry its life time is unlimited and we don't have to care about someone
-/// changing the entry under our feet.
+/// per-thread pawn hash tables so that once we get a pointer to an entry its
+/// life time is unlimited and we don't have to care about someone changing the
+/// entry under our feet. The material table is shared and read-only.
 
 class Thread
 {
 	std::thread nativeThread;
 	Mutex mutex;
 	ConditionVariable sleepCondition;
-	bool exit, searching;
+	bool exit, searching, inSearch;
+	std::deque<std::function<void()>> tasks;
 
 public:
 	Thread();
@@ -33,17 +55,23 @@ public:
 	virtual void search();
 	void idle_loop();
 	void start_searching(bool resume = false);
+	void run_task(std::function<void()> f);
 	void wait_for_search_finished();
+	void wait_for_search_over();
 	void wait(std::atomic_bool& b);
+	bool search_running();
 
 	Pawns::Table pawnsTable;
-	Material::Table materialTable;
-	Endgames endgames;
+	Material::Entry materialEntry;
+	QSearchTable qsTable;
+	Eval::Cache evalCache;
 	size_t idx, PVIdx;
 	int maxPly, callsCnt;
-	uint64_t tbHits;
+	uint64_t perftNodes, pickerNodes, movesGenerated, ttProbes, ttHits;
+	Counters counters;
 
 	Position rootPos;
+	StateInfo rootState;
 	Search::RootMoves rootMoves;
 	Depth rootDepth;
 	Depth completedDepth;
@@ -63,6 +91,29 @@ struct MainThread : public Thread
 	bool easyMovePlayed, failedLow;
 	double bestMoveChanges;
 	Value previousScore;
+	TimePoint timerFired;
+};
+
+/// TimerThread sleeps until the deadline of a timed search and then raises
+/// Signals.stop, so that the search threads don't have to poll the clock. While
+/// pondering it waits for "ponderhit" before stopping the search. Limits on
+/// nodes, including the nodes as time mode, are still checked by the search.
+
+class TimerThread
+{
+	std::thread nativeThread;
+	Mutex mutex;
+	ConditionVariable sleepCondition;
+	bool exit, armed;
+	TimePoint deadline, fired;
+
+public:
+	TimerThread();
+	~TimerThread();
+	void idle_loop();
+	void arm(TimePoint stopTime);
+	TimePoint disarm();
+	void wake_up();
 };
 
 /// ThreadPool struct handles all the threads-related stuff like init, starting,
@@ -77,11 +128,24 @@ struct ThreadPool : public std::vector<Thread*>
 
 	MainThread* main() { return static_cast<MainThread*>(at(0)); }
 	void start_thinking(Position&, StateListPtr&, const Search::LimitsType&);
+	void wait_for_idle();
+	bool searching() { return !empty() && main()->search_running(); }
 	void read_uci_options();
 	uint64_t nodes_searched() const;
 	uint64_t tb_hits() const;
+	uint64_t perft_nodes() const;
+	uint64_t eval_cache_probes() const;
+	uint64_t eval_cache_hits() const;
+	uint64_t tt_probes() const;
+	uint64_t tt_hits() const;
+	double moves_generated_per_node() const;
+
+	TimerThread* timer;
+	bool bindThreads, threadsPending = false;
 
 private:
+	template<typename T> T* create_thread();
+
 	StateListPtr setupStates;
 };
 
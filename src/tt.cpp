@@ -1,10 +1,59 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring> // For std::memset
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 #include "bitboard.h"
+#include "thread.h"
 #include "tt.h"
 
 TranspositionTable TT; // Our global transposition table
 
+namespace Zobrist
+{
+	extern Key side;
+}
+
+namespace
+{
+	// Header of a table snapshot file. Version changes with the layout of
+	// TTEntry or the way keys are split between index and entry, and the
+	// Zobrist side key fingerprints the hash keys themselves.
+	struct SnapshotHeader
+	{
+		char     magic[8];
+		uint32_t version;
+		uint32_t clusterBytes;
+		uint64_t clusterCount;
+		uint64_t zobrist;
+		uint8_t  generation;
+		char     padding[7];
+	};
+
+	const char SnapshotMagic[8] = { 'X', 'Q', 'T', 'T', 'S', 'N', 'A', 'P' };
+	const uint32_t SnapshotVersion = 1;
+
+	// Header of a table in a shared memory segment, filling one cache line in
+	// front of the clusters. The creator sets ready once the rest is written.
+	struct SharedHeader
+	{
+		char     magic[8];
+		uint32_t clusterBytes;
+		std::atomic<uint32_t> ready;
+		uint64_t clusterCount;
+		uint64_t zobrist;
+		std::atomic<uint32_t> users; // Processes mapping the segment
+		char     padding[28];
+	};
+
+	const char SharedMagic[8] = { 'X', 'Q', 'T', 'T', 'S', 'H', 'M', '2' };
+}
+
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
@@ -14,70 +63,315 @@ void TranspositionTable::resize(size_t mbSize)
 
 	size_t newClusterCount = size_t(1) << msb((mbSize * 1024 * 1024) / sizeof(Cluster));
 
-	if (newClusterCount == clusterCount)
+	if (newClusterCount == requestedClusters)
 		return;
 
-	clusterCount = newClusterCount;
+	requestedClusters = newClusterCount;
+	reallocate();
+}
+
+/// TranspositionTable::set_memory_policy() selects the kind of pages backing
+/// the table and how they are spread over the NUMA nodes. The table is
+/// allocated again, so its content is lost.
+
+void TranspositionTable::set_memory_policy(bool largePages, NumaPolicy policy)
+{
+	hugePages = largePages;
+	numaPolicy = policy;
+
+	if (requestedClusters)
+		reallocate();
+}
+
+/// TranspositionTable::set_shared() moves the table to the named shared memory
+/// segment, or back to private memory when the name is empty.
+
+void TranspositionTable::set_shared(const std::string& name)
+{
+	sharedName = name;
+
+	if (requestedClusters)
+		reallocate();
+}
+
+/// TranspositionTable::reallocate() allocates the table again once no thread
+/// uses it. During a search this is left to the main thread, which runs it as a
+/// task when the search is over, so that the UCI loop doesn't wait. The memory
+/// info then says so until the task reports the new table.
 
-	free(mem);
-	mem = calloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1, 1);
+void TranspositionTable::reallocate()
+{
+	if (Threads.searching())
+	{
+		memoryInfo = "pending until the search is over";
+		Threads.main()->run_task([this] {
+			allocate();
+			sync_cout << "info string Hash: " << memoryInfo << sync_endl;
+		});
+	}
+	else
+	{
+		Threads.wait_for_idle(); // Could still be clearing the old table
+		allocate();
+	}
+}
+
+/// TranspositionTable::allocate() gets memory for the requested number of
+/// clusters according to the memory policy and has the threads clear it, unless
+/// the fresh pages are left to be first touched by the search. Pages are page
+/// aligned, hence also cache line aligned. A shared table is not cleared, and
+/// when the segment can't be used we fall back to a private table.
+
+void TranspositionTable::allocate()
+{
+	std::string pages;
+
+	release();
+
+	if (!sharedName.empty() && attach_shared())
+		return;
+
+	clusterCount = requestedClusters;
+	memSize = clusterCount * sizeof(Cluster);
+	mem = alloc_large(memSize, hugePages, numaPolicy == NUMA_INTERLEAVE, pages);
 
 	if (!mem)
 	{
-		std::cerr << "Failed to allocate " << mbSize
+		std::cerr << "Failed to allocate " << clusterCount * sizeof(Cluster) / (1024 * 1024)
 			<< "MB for transposition table." << std::endl;
 		exit(EXIT_FAILURE);
 	}
 
-	table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+	table = (Cluster*)mem;
+	memoryInfo = std::to_string(clusterCount * sizeof(Cluster) / (1024 * 1024)) + " MB on " + pages
+				+ (numaPolicy == NUMA_DEFAULT ? ", first touched by the search threads" : "")
+				+ (numaPolicy == NUMA_FIRST_TOUCH ? ", first touched by the search" : "")
+				+ (sharedName.empty() ? "" : ", shared segment " + sharedName + " unavailable");
+
+#if defined(TT_STATS)
+	fullKeys.assign(clusterCount * ClusterSize, 0);
+	reset_stats();
+#endif
+
+	if (numaPolicy != NUMA_FIRST_TOUCH)
+		clear();
+}
+
+/// TranspositionTable::attach_shared() maps the segment named sharedName. The
+/// segment starts with a header, written by the process that created it and
+/// published through the ready flag. Other processes wait for the flag and then
+/// check that the segment holds a table they can use, adopting its size. The
+/// header counts the processes using the segment, and the last one to leave
+/// removes it, see release(), so that a later run starts from a fresh table.
+
+bool TranspositionTable::attach_shared()
+{
+	static_assert(sizeof(SharedHeader) == CacheLineSize, "SharedHeader size incorrect");
+
+	size_t size;
+	bool created;
+	SharedHeader* header;
+
+	// A segment whose last user is leaving is about to be removed: wait for it
+	// to go and create a new one.
+	for (int tries = 0; ; ++tries)
+	{
+		size = sizeof(SharedHeader) + requestedClusters * sizeof(Cluster);
+
+		if (!(mem = map_shared(sharedName, size, created)))
+			return false;
+
+		header = (SharedHeader*)mem;
+
+		if (created)
+		{
+			std::memcpy(header->magic, SharedMagic, sizeof(SharedMagic));
+			header->clusterBytes = sizeof(Cluster);
+			header->clusterCount = requestedClusters;
+			header->zobrist = Zobrist::side;
+			header->users = 1;
+			header->ready.store(1, std::memory_order_release);
+			break;
+		}
+
+		for (int i = 0; i < 1000 && !header->ready.load(std::memory_order_acquire); ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		if (   !header->ready.load(std::memory_order_acquire)
+			|| std::memcmp(header->magic, SharedMagic, sizeof(SharedMagic))
+			|| header->clusterBytes != sizeof(Cluster)
+			|| header->zobrist != Zobrist::side
+			|| !header->clusterCount
+			|| (header->clusterCount & (header->clusterCount - 1))
+			|| (size - sizeof(SharedHeader)) / sizeof(Cluster) < header->clusterCount)
+		{
+			unmap_shared(mem, size);
+			mem = nullptr;
+			return false;
+		}
+
+		uint32_t users = header->users.load();
+
+		while (users && !header->users.compare_exchange_weak(users, users + 1)) {}
+
+		if (users)
+			break;
+
+		unmap_shared(mem, size);
+		mem = nullptr;
+
+		if (tries == 100)
+			return false;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	shared = true;
+	attachedName = sharedName;
+	memSize = size;
+	clusterCount = size_t(header->clusterCount);
+	table = (Cluster*)(header + 1);
+	memoryInfo = std::to_string(clusterCount * sizeof(Cluster) / (1024 * 1024)) + " MB shared as "
+				+ sharedName + (created ? " (created)" : " (attached)");
+
+#if defined(TT_STATS)
+	fullKeys.assign(clusterCount * ClusterSize, 0);
+	reset_stats();
+#endif
+
+	return true;
+}
+
+/// TranspositionTable::release() gives back the memory of the table
+
+void TranspositionTable::release()
+{
+	if (shared)
+	{
+		if (((SharedHeader*)mem)->users.fetch_sub(1) == 1)
+			remove_shared(attachedName);
+
+		unmap_shared(mem, memSize);
+	}
+	else
+		free_large(mem, memSize);
+
+	mem = nullptr;
+	table = nullptr;
+	shared = false;
 }
 
 /// TranspositionTable::clear() overwrites the entire transposition table
 /// with zeros. It is called whenever the table is resized, or when the
-/// user asks the program to clear the table (from the UCI interface).
+/// user asks the program to clear the table (from the UCI interface). Each
+/// thread of the pool zeroes a slice in the background, and the function
+/// returns at once. Threads.wait_for_idle() waits for the table to be ready,
+/// which ThreadPool::start_thinking() does before every search. With
+/// NUMA_FIRST_TOUCH the table is allocated again instead, so that no page is
+/// touched before the search does.
 
 void TranspositionTable::clear() 
 {
 
-	std::memset(table, 0, clusterCount * sizeof(Cluster));
+	if (numaPolicy == NUMA_FIRST_TOUCH && !shared)
+	{
+		reallocate();
+		return;
+	}
+
+	size_t threadCount = Threads.size();
+
+	for (Thread* th : Threads)
+		th->run_task([this, th, threadCount] { clear_slice(th->idx, threadCount); });
+}
+
+/// TranspositionTable::clear_slice() zeroes the idx-th of count equal slices
+/// of the table, the last one taking the remainder. A shared table is left
+/// alone, as other processes are searching with it.
+
+void TranspositionTable::clear_slice(size_t idx, size_t count)
+{
+
+	if (shared)
+		return;
+
+	size_t stride = clusterCount / count;
+	size_t start = stride * idx;
+	size_t len = idx != count - 1 ? stride : clusterCount - start;
+
+	std::memset(&table[start], 0, len * sizeof(Cluster));
+
+#if defined(TT_STATS)
+	std::fill(fullKeys.begin() + start * ClusterSize, fullKeys.begin() + (start + len) * ClusterSize, 0);
+#endif
 }
 
 /// TranspositionTable::probe() looks up the current position in the transposition
 /// table. It returns true and a pointer to the TTEntry if the position is found.
 /// Otherwise, it returns false and a pointer to an empty or least valuable TTEntry
 /// to be replaced later. The replace value of an entry is calculated as its depth
-/// minus 8 times its relative age. TTEntry t1 is considered more valuable than
-/// TTEntry t2 if its replace value is greater than that of t2.
+/// minus 8 times its relative age, and entries holding only a static evaluation
+/// are the first to go. TTEntry t1 is considered more valuable than TTEntry t2
+/// if its replace value is greater than that of t2.
 
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const 
 {
 
-	TTEntry* const tte = first_entry(key);
-	const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
+	TTEntry* const tte = probe_cluster(first_entry(key), key, found);
+
+#if defined(TT_STATS)
+	size_t idx = ((const char*)tte - (const char*)table) / sizeof(Cluster);
+
+	++probes;
+
+	if (found)
+		++hits, falseHits += fullKeys[idx * ClusterSize + (tte - table[idx].entry)] != key;
+
+	else if (tte->key32)
+		++evictions;
+#endif
+
+	return tte;
+}
+
+/// TranspositionTable::probe_cluster() does the work of probe() on the cluster
+/// starting at tte, which can also be in a QSearchTable.
+
+TTEntry* TranspositionTable::probe_cluster(TTEntry* const tte, const Key key, bool& found) const
+{
+
+	const uint32_t key32 = key >> 32;  // Use the high 32 bits as key inside the cluster
 
 	for (int i = 0; i < ClusterSize; ++i)
-		if (!tte[i].key16 || tte[i].key16 == key16)
+		if (!tte[i].key32 || tte[i].key32 == key32)
 		{
-			if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key16)
+			if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key32)
 				tte[i].genBound8 = uint8_t(generation8 | tte[i].bound()); // Refresh
 
-			return found = (bool)tte[i].key16, &tte[i];
+			return found = (bool)tte[i].key32, &tte[i];
 		}
 
 	// Find an entry to be replaced according to the replacement strategy
 	TTEntry* replace = tte;
 	for (int i = 1; i < ClusterSize; ++i)
-		// Due to our packed storage format for generation and its cyclic
-		// nature we add 259 (256 is the modulus plus 3 to keep the lowest
-		// two bound bits from affecting the result) to calculate the entry
-		// age correctly even after generation8 overflows into the next cycle.
-		if (replace->depth8 - ((259 + generation8 - replace->genBound8) & 0xFC) * 2
-	>   tte[i].depth8 - ((259 + generation8 - tte[i].genBound8) & 0xFC) * 2)
+		if (replace_value(replace) > replace_value(&tte[i]))
 			replace = &tte[i];
 
 	return found = false, replace;
 }
 
+/// TranspositionTable::replace_value() is the value of an entry for the
+/// replacement strategy. Due to our packed storage format for generation and
+/// its cyclic nature we add 259 (256 is the modulus plus 3 to keep the lowest
+/// two bound bits from affecting the result) to calculate the entry age
+/// correctly even after generation8 overflows into the next cycle.
+
+int TranspositionTable::replace_value(const TTEntry* tte) const
+{
+	return tte->depth8 - ((259 + generation8 - tte->genBound8) & 0xFC) * 2
+		- (tte->bound() == BOUND_NONE ? 2 * MAX_PLY : 0);
+}
+
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
@@ -93,4 +387,185 @@ int TranspositionTable::hashfull() const
 				cnt++;
 	}
 	return cnt;
-}
\ No newline at end of file
+}
+
+/// TranspositionTable::save() writes a snapshot of the table, a header followed
+/// by the raw clusters, to the given file. It returns a message for the GUI.
+
+std::string TranspositionTable::save(const std::string& fileName) const
+{
+	if (Threads.searching())
+		return "Hash not saved, stop the search first";
+
+	Threads.wait_for_idle(); // Let a background clear finish
+
+	std::ofstream file(fileName, std::ios::binary);
+	SnapshotHeader h = {};
+
+	std::memcpy(h.magic, SnapshotMagic, sizeof(h.magic));
+	h.version = SnapshotVersion;
+	h.clusterBytes = sizeof(Cluster);
+	h.clusterCount = clusterCount;
+	h.zobrist = Zobrist::side;
+	h.generation = generation8;
+
+	file.write((const char*)&h, sizeof(h));
+	file.write((const char*)table, clusterCount * sizeof(Cluster));
+
+	if (!file)
+		return "Unable to write hash file " + fileName;
+
+	return "Hash saved to " + fileName;
+}
+
+/// TranspositionTable::load() reads back a snapshot written by save(). Files
+/// from another layout or key scheme are rejected. A snapshot of the same size
+/// is read straight into the table. Otherwise the clusters are streamed in
+/// small chunks and their entries rehashed: the low bits of a key are the
+/// index of the cluster it was found in, and its high 32 bits are stored in
+/// the entry. Into a smaller table, every entry is then stored through
+/// probe() like a search would, keeping the most valuable ones. Into a bigger
+/// table the missing index bits are unknown, so a cluster is copied to every
+/// cluster its entries could belong to; the copies that don't match any
+/// position are soon replaced.
+
+std::string TranspositionTable::load(const std::string& fileName)
+{
+	if (Threads.searching())
+		return "Hash not loaded, stop the search first";
+
+	Threads.wait_for_idle();
+
+	std::ifstream file(fileName, std::ios::binary);
+	SnapshotHeader h;
+
+	if (!file.read((char*)&h, sizeof(h)))
+		return "Unable to read hash file " + fileName;
+
+	if (   std::memcmp(h.magic, SnapshotMagic, sizeof(h.magic))
+		|| h.version != SnapshotVersion
+		|| h.clusterBytes != sizeof(Cluster)
+		|| h.zobrist != Zobrist::side
+		|| !h.clusterCount
+		|| (h.clusterCount & (h.clusterCount - 1)))
+		return "Hash file " + fileName + " does not match this engine";
+
+	std::memset(table, 0, clusterCount * sizeof(Cluster));
+	generation8 = h.generation;
+
+	if (h.clusterCount == clusterCount)
+		file.read((char*)table, clusterCount * sizeof(Cluster));
+	else
+	{
+		const size_t ChunkSize = 4096;
+		std::vector<Cluster> chunk(ChunkSize);
+
+		for (size_t first = 0; first < h.clusterCount && file; first += ChunkSize)
+		{
+			size_t n = std::min(size_t(h.clusterCount - first), ChunkSize);
+
+			if (!file.read((char*)chunk.data(), n * sizeof(Cluster)))
+				break;
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				size_t idx = first + i;
+
+				if (h.clusterCount < clusterCount)
+				{
+					for (size_t dst = idx; dst < clusterCount; dst += h.clusterCount)
+						table[dst] = chunk[i];
+					continue;
+				}
+
+				for (const TTEntry& e : chunk[i].entry)
+				{
+					if (!e.key32)
+						continue;
+
+					bool found;
+					TTEntry* tte = probe((Key(e.key32) << 32) | idx, found);
+
+					if (found ? tte->depth8 >= e.depth8
+							  : tte->key32 && replace_value(tte) >= replace_value(&e))
+						continue;
+
+					*tte = e;
+				}
+			}
+		}
+	}
+
+	if (!file)
+	{
+		std::memset(table, 0, clusterCount * sizeof(Cluster));
+		return "Hash file " + fileName + " is truncated, hash cleared";
+	}
+
+	return "Hash loaded from " + fileName + " ("
+		+ std::to_string(h.clusterCount * sizeof(Cluster) / (1024 * 1024)) + " MB into "
+		+ std::to_string(clusterCount * sizeof(Cluster) / (1024 * 1024)) + " MB)";
+}
+
+/// QSearchTable::set_enabled() allocates the table, with the clusters aligned
+/// to the cache lines inside a zeroed buffer, or frees it.
+
+void QSearchTable::set_enabled(bool enable)
+{
+	const uintptr_t mask = TranspositionTable::CacheLineSize - 1;
+
+	if (enable == !buffer.empty())
+		return;
+
+	std::vector<char>(enable ? (Size + 1) * sizeof(Cluster) : 0).swap(buffer);
+	table = enable ? (Cluster*)((uintptr_t(buffer.data()) + mask) & ~mask) : nullptr;
+}
+
+void QSearchTable::clear()
+{
+	if (table)
+		std::memset(table, 0, Size * sizeof(Cluster));
+}
+
+#if defined(TT_STATS)
+
+/// TranspositionTable::record_save() keeps aside the full key of an entry
+/// being written, so that probe() can tell true hits from false ones.
+
+void TranspositionTable::record_save(const TTEntry* tte, Key key)
+{
+	if (tte < &table[0].entry[0] || tte >= &table[clusterCount].entry[0])
+		return; // Entry of a QSearchTable
+
+	size_t idx = ((const char*)tte - (const char*)table) / sizeof(Cluster);
+
+	fullKeys[idx * ClusterSize + (tte - table[idx].entry)] = key;
+}
+
+void TranspositionTable::reset_stats()
+{
+	probes = hits = falseHits = evictions = 0;
+}
+
+/// TranspositionTable::stats() reports the counters gathered since the last
+/// reset. A false hit is an entry whose 32 key bits match the probed position
+/// while its full key does not.
+
+std::string TranspositionTable::stats() const
+{
+	std::stringstream ss;
+	uint64_t p = std::max(probes.load(), uint64_t(1)), h = std::max(hits.load(), uint64_t(1));
+
+	ss << "TT entries    : " << clusterCount * ClusterSize
+	   << "\nTT probes     : " << probes
+	   << "\nTT hits       : " << hits      << std::fixed << std::setprecision(2)
+	   << " (" << 100.0 * hits / p << "% of probes)"
+	   << "\nTT false hits : " << falseHits << std::setprecision(6)
+	   << " (" << 100.0 * falseHits / h << "% of hits)"
+	   << "\nTT evictions  : " << evictions << std::setprecision(2)
+	   << " (" << 100.0 * evictions / p << "% of probes)";
+
+	return ss.str();
+}
+
+#endif
\ No newline at end of file
@@ -1,12 +1,19 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <string>
+#include <vector>
+
+#if defined(TT_STATS)
+#include <atomic>
+#endif
+
 #include "misc.h"
 #include "types.h"
 
-/// TTEntry struct is the 10 bytes transposition table entry, defined as below:
+/// TTEntry struct is the 12 bytes transposition table entry, defined as below:
 ///
-/// key        16 bit
+/// key        32 bit
 /// move       16 bit
 /// value      16 bit
 /// eval value 16 bit
@@ -22,31 +29,12 @@ struct TTEntry {
 	Depth depth() const { return (Depth)(depth8 * int(ONE_PLY)); }
 	Bound bound() const { return (Bound)(genBound8 & 0x3); }
 
-	void save(Key k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g) 
-	{		
-
-		// Preserve any existing move for the same position
-		if (m || (k >> 48) != key16)
-			move16 = (uint16_t)m;
-
-		// Don't overwrite more valuable entries
-		if ((k >> 48) != key16
-			|| d / ONE_PLY > depth8 - 4
-			/* || g != (genBound8 & 0xFC) // Matching non-zero keys are already refreshed by probe() */
-			|| b == BOUND_EXACT)
-		{
-			key16 = (uint16_t)(k >> 48);
-			value16 = (int16_t)v;
-			eval16 = (int16_t)ev;
-			genBound8 = (uint8_t)(g | b);
-			depth8 = (int8_t)(d / ONE_PLY);
-		}
-	}
+	void save(Key k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g);
 
 private:
 	friend class TranspositionTable;
 
-	uint16_t key16;
+	uint32_t key32;
 	uint16_t move16;
 	int16_t  value16;
 	int16_t  eval16;
@@ -56,44 +44,153 @@ private:
 
 /// A TranspositionTable consists of a power of 2 number of clusters and each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
-/// contains information of exactly one position. The size of a cluster should
-/// divide the size of a cache line size, to ensure that clusters never cross
-/// cache lines. This ensures best cache performance, as the cacheline is
-/// prefetched, as soon as possible.
+/// contains information of exactly one position. A cluster fills a whole cache
+/// line, so a probe touches a single line and a prefetch brings in the entire
+/// bucket. The low bits of the key select the cluster and the high 32 bits are
+/// stored in the entry, keeping the two independent up to 2^32 clusters.
+///
+/// The table lives in memory from alloc_large(), on huge pages where the OS
+/// grants them. It is cleared by the search threads, each zeroing one slice,
+/// so by default its pages are first touched by the threads that use them.
+/// They can be interleaved over the NUMA nodes instead, or, with
+/// NUMA_FIRST_TOUCH, left for the search threads to fault in while searching.
+/// Clearing then hands back fresh untouched pages instead of zeroing them.
+///
+/// A search keeps using the table, so the UCI loop doesn't wait for it to
+/// allocate the table again: the main thread does it when the search is over.
+///
+/// Several engine processes can share one table through a named shared memory
+/// segment, set with set_shared(). The first process creates the segment with
+/// its own size and the later ones attach to it, whatever their Hash setting.
+/// Only the generation stays private to each process. The segment is removed
+/// when the last process leaves it.
+///
+/// qsearch() can keep its entries out of the table, in the QSearchTable of its
+/// thread, so that they don't crowd out the entries of the main search.
+///
+/// save() and load() keep a snapshot of the table in a file, so that a long
+/// analysis survives a restart of the engine.
+///
+/// Compiling with -DTT_STATS keeps the full key of every entry aside and counts
+/// probes, hits, false hits and evictions. The counters are printed by the
+/// "ttstats" command and at the end of a bench run.
 
 class TranspositionTable {
 
+	friend class QSearchTable;
+
 	static const int CacheLineSize = 64;
-	static const int ClusterSize = 3;
+	static const int ClusterSize = 5;
 
 	struct Cluster {
 		TTEntry entry[ClusterSize];
-		char padding[2]; // Align to a divisor of the cache line size
+		char padding[4]; // Pad to the cache line size
 	};
 
-	static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
+	static_assert(sizeof(Cluster) == CacheLineSize, "Cluster size incorrect");
 
 public:
-	~TranspositionTable() { free(mem); }
+	enum NumaPolicy { NUMA_DEFAULT, NUMA_INTERLEAVE, NUMA_FIRST_TOUCH };
+
+	~TranspositionTable() { release(); }
 	void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
 	uint8_t generation() const { return generation8; }
 	TTEntry* probe(const Key key, bool& found) const;
 	int hashfull() const;
 	void resize(size_t mbSize);
 	void clear();
+	void set_memory_policy(bool largePages, NumaPolicy policy);
+	void set_shared(const std::string& name);
+	const std::string& memory_info() const { return memoryInfo; }
+	std::string save(const std::string& fileName) const;
+	std::string load(const std::string& fileName);
 
 	// The lowest order bits of the key are used to get the index of the cluster
 	TTEntry* first_entry(const Key key) const {
 		return &table[(size_t)key & (clusterCount - 1)].entry[0];
 	}
 
+#if defined(TT_STATS)
+	void record_save(const TTEntry* tte, Key key);
+	void reset_stats();
+	std::string stats() const;
+#endif
+
 private:
-	size_t clusterCount;
-	Cluster* table;
-	void* mem;
+	void reallocate();
+	void allocate();
+	void clear_slice(size_t idx, size_t count);
+	TTEntry* probe_cluster(TTEntry* const tte, const Key key, bool& found) const;
+	bool attach_shared();
+	void release();
+	int replace_value(const TTEntry* tte) const;
+
+	size_t clusterCount = 0;
+	size_t requestedClusters = 0;
+	Cluster* table = nullptr;
+	void* mem = nullptr;
+	size_t memSize = 0;
+	bool hugePages = true;
+	NumaPolicy numaPolicy = NUMA_DEFAULT;
+	std::string sharedName, attachedName;
+	bool shared = false;
+	std::string memoryInfo;
 	uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+
+#if defined(TT_STATS)
+	std::vector<Key> fullKeys;
+	mutable std::atomic<uint64_t> probes, hits, falseHits, evictions;
+#endif
 };
 
 extern TranspositionTable TT;
 
+/// QSearchTable is a small table of the same clusters, private to a thread and
+/// sized to stay in its L2 cache. With the "QSearch Hash" option qsearch() stores
+/// its entries there when the position is not in the main table, which is thus
+/// kept for the real depths. Entries follow the generation of the main table.
+/// The table is only allocated while the option is on.
+
+class QSearchTable {
+
+	typedef TranspositionTable::Cluster Cluster;
+
+public:
+	static const size_t Size = 4096; // Clusters, 256 KB
+
+	TTEntry* probe(const Key key, bool& found) const {
+		return TT.probe_cluster(&table[(size_t)key & (Size - 1)].entry[0], key, found);
+	}
+	void set_enabled(bool enable);
+	void clear();
+
+private:
+	std::vector<char> buffer;
+	Cluster* table = nullptr;
+};
+
+inline void TTEntry::save(Key k, Value v, Bound b, Depth d, Move m, Value ev, uint8_t g)
+{
+
+	// Preserve any existing move for the same position
+	if (m || uint32_t(k >> 32) != key32)
+		move16 = (uint16_t)m;
+
+	// Don't overwrite more valuable entries
+	if (uint32_t(k >> 32) != key32
+		|| d / ONE_PLY > depth8 - 4
+		/* || g != (genBound8 & 0xFC) // Matching non-zero keys are already refreshed by probe() */
+		|| b == BOUND_EXACT)
+	{
+#if defined(TT_STATS)
+		TT.record_save(this, k);
+#endif
+		key32 = uint32_t(k >> 32);
+		value16 = (int16_t)v;
+		eval16 = (int16_t)ev;
+		genBound8 = (uint8_t)(g | b);
+		depth8 = (int8_t)(d / ONE_PLY);
+	}
+}
+
 #endif
\ No newline at end of file
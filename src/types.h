@@ -3,13 +3,31 @@
 
 #include <cstdint>
 #include <string>
-#include <nmmintrin.h>	// Intel and Microsoft header for _mm_popcnt_u64()
+
+#if defined(_MSC_VER)
 #include <intrin.h>		// Microsoft header for _BitScanForward64()
-#include <xmmintrin.h> // Intel and Microsoft header for _mm_prefetch()
+#include <nmmintrin.h>	// Intel and Microsoft header for _mm_popcnt_u64()
+#endif
 
-#include <immintrin.h> // Header for _pext_u64() intrinsic
+#include <immintrin.h> // Header for _pext_u64() intrinsic, SSE2 types and _mm_prefetch()
 #define pext(b, m) _pext_u64(b, m)
 
+/// Code calling pext() is compiled for BMI2 even when the rest of the binary
+/// is not (no -mbmi2), and is only run when the CPU supports it, see
+/// cpu_has_fast_pext(). MSVC emits the intrinsics without any switch.
+#if defined(__GNUC__) && !defined(__BMI2__)
+#define TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+#define TARGET_BMI2
+#endif
+
+/// Likewise for AVX2 code, only run when cpu_has_avx2() says so
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
 #if defined(_MSC_VER)
 // Disable some silly and noisy warning from MSVC compiler
 #pragma warning(disable: 4127) // Conditional expression is constant
@@ -17,53 +35,65 @@
 #pragma warning(disable: 4800) // Forcing value to bool 'true' or 'false'
 #endif
 
-#define MM_SHL_SI128(v, n) \
-{ \
-    __m128i v1, v2; \
- \
-    if (n >> 6) \
-    { \
-        v1 = _mm_slli_si128(v, 8); \
-        v1 = _mm_slli_epi64(v1, (n) - 64); \
-    } \
-    else \
-    { \
-        v1 = _mm_slli_epi64(v, n); \
-        v2 = _mm_slli_si128(v, 8); \
-        v2 = _mm_srli_epi64(v2, 64 - (n)); \
-        v1 = _mm_or_si128(v1, v2); \
-    } \
-    v = v1; \
-}
+/// Bitboard backend selection. The 90 points of the board live in a 128 bit
+/// Bitboard which can be stored in one of three ways, chosen at compile time
+/// by defining exactly one of the macros below (e.g. -DBB_UINT64X2):
+///
+/// BB_SSE2      an __m128i register, the original MSVC implementation
+/// BB_INT128    a GCC/Clang unsigned __int128
+/// BB_UINT64X2  a plain pair of uint64_t, portable to any 64 bit compiler
+///
+/// All backends are bit-identical. When nothing is defined we use __int128
+/// where the compiler has it and SSE2 otherwise.
+#if !defined(BB_SSE2) && !defined(BB_INT128) && !defined(BB_UINT64X2)
+#  if defined(__SIZEOF_INT128__)
+#    define BB_INT128
+#  elif defined(_M_X64) || defined(__SSE2__)
+#    define BB_SSE2
+#  else
+#    define BB_UINT64X2
+#  endif
+#endif
 
-#define MM_SHR_SI128(v, n) \
-{ \
-    __m128i v1, v2; \
- \
-    if (n >> 6) \
-    { \
-        v1 = _mm_srli_si128(v, 8); \
-        v1 = _mm_srli_epi64(v1, (n) - 64); \
-    } \
-    else \
-    { \
-        v1 = _mm_srli_epi64(v, n); \
-        v2 = _mm_srli_si128(v, 8); \
-        v2 = _mm_slli_epi64(v2, 64 - (n)); \
-        v1 = _mm_or_si128(v1, v2); \
-    } \
-    v = v1; \
-}
+#if defined(BB_SSE2)
+#  define BB_BACKEND "SSE2"
+#elif defined(BB_INT128)
+#  define BB_BACKEND "INT128"
+#else
+#  define BB_BACKEND "UINT64X2"
+#endif
 
-inline int pext_si128(__m128i src, __m128i mask)
+/// popcount64(), lsb64() and msb64() are the 64 bit building blocks of the
+/// Bitboard bit scans. lsb64() and msb64() require a non-zero argument.
+inline int popcount64(uint64_t b)
 {
-	int shift;
-	uint64_t low = pext(src.m128i_u64[0], mask.m128i_u64[0]);
-	uint64_t high = pext(src.m128i_u64[1], mask.m128i_u64[1]);
+#if defined(_MSC_VER)
+	return (int)_mm_popcnt_u64(b);
+#else
+	return __builtin_popcountll(b);
+#endif
+}
 
-	shift = (int)_mm_popcnt_u64(mask.m128i_u64[0]);
+inline int lsb64(uint64_t b)
+{
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward64(&idx, b);
+	return (int)idx;
+#else
+	return __builtin_ctzll(b);
+#endif
+}
 
-	return ((high << shift) | low) & 0xFFFFFFFF;
+inline int msb64(uint64_t b)
+{
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanReverse64(&idx, b);
+	return (int)idx;
+#else
+	return 63 ^ __builtin_clzll(b);
+#endif
 }
 
 struct sPair64
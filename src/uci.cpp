@@ -8,6 +8,7 @@
 #include "search.h"
 #include "thread.h"
 #include "timeman.h"
+#include "tt.h"
 #include "uci.h"
 
 #ifdef _DEBUG
@@ -16,7 +17,7 @@
 
 using namespace std;
 
-void benchmark(const Position& pos, istream& is) { }
+extern void benchmark(const Position& pos, istream& is);
 
 namespace
 {
@@ -111,6 +112,7 @@ namespace
 			else if (token == "nodes")     is >> limits.nodes;
 			else if (token == "movetime")  is >> limits.movetime;
 			else if (token == "mate")      is >> limits.mate;
+			else if (token == "perft")     is >> limits.perft;
 			else if (token == "infinite")  limits.infinite = 1;
 			else if (token == "ponder")    limits.ponder = 1;
 
@@ -165,7 +167,10 @@ void UCI::loop(int argc, char* argv[])
 			Threads.main()->start_searching(true); // Could be sleeping
 		}
 		else if (token == "ponderhit")
+		{
 			Search::Limits.ponder = 0; // Switch to normal search
+			Threads.timer->wake_up(); // Could be past the deadline
+		}
 		else if (token == "uci")
 			sync_cout << "id name " << engine_info(true)
 			<< "\n" << Options
@@ -183,8 +188,21 @@ void UCI::loop(int argc, char* argv[])
 
 		// Additional custom non-UCI commands, useful for debugging		
 		else if (token == "bench")      benchmark(pos, is);
+		else if (token == "bbbench")    Bitboards::bench(is);
+		else if (token == "pickbench")  scoring_bench(pos, is);
 		else if (token == "d")          sync_cout << pos << sync_endl;
 		else if (token == "eval")       sync_cout << Eval::trace(pos) << sync_endl;
+#if defined(TT_STATS)
+		else if (token == "ttstats")    sync_cout << TT.stats() << sync_endl, TT.reset_stats();
+#endif
+		else if (token == "savehash" || token == "loadhash")
+		{
+			string fileName;
+
+			getline(is >> ws, fileName);
+			string result = token == "savehash" ? TT.save(fileName) : TT.load(fileName);
+			sync_cout << "info string " << result << sync_endl;
+		}
 		else if (token == "perft")
 		{
 			int depth;
@@ -30,12 +30,14 @@ public:
 	Option(OnChange = nullptr);
 	Option(bool v, OnChange = nullptr);
 	Option(const char* v, OnChange = nullptr);
+	Option(const char* v, const char* cur, OnChange = nullptr);
 	Option(int v, int min, int max, OnChange = nullptr);
 
 	Option& operator=(const std::string&);
 	void operator<<(const Option&);
 	operator int() const;
 	operator std::string() const;
+	bool operator==(const char*) const;
 
 private:
 	friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
-#include <ostream>
+#include <iostream>
+#include <sstream>
 
 #include "misc.h"
 #include "search.h"
@@ -17,11 +18,31 @@ namespace UCI
 
 /// 'On change' actions, triggered by an option's value change
 void on_clear_hash(const Option&) { Search::clear(); }
-void on_hash_size(const Option& o) { TT.resize(o); }
+void on_hash_size(const Option& o) { TT.resize(o); sync_cout << "info string Hash: " << TT.memory_info() << sync_endl; }
 void on_logger(const Option& o) { start_logger(o); }
 void on_threads(const Option&) { Threads.read_uci_options(); }
+void on_pext_sliders(const Option& o) { Bitboards::use_pext_sliders(o); }
+void on_avx2_scoring(const Option& o) { use_avx2_scoring(o); }
 void on_tb_path(const Option& o) {  }
 
+void on_hash_memory(const Option&)
+{
+	TT.set_memory_policy(Options["Large Pages"],
+		  Options["Hash NUMA"] == "Interleave" ? TranspositionTable::NUMA_INTERLEAVE
+		: Options["Hash NUMA"] == "FirstTouch" ? TranspositionTable::NUMA_FIRST_TOUCH
+		: TranspositionTable::NUMA_DEFAULT);
+
+	sync_cout << "info string Hash: " << TT.memory_info() << sync_endl;
+}
+
+void on_shared_hash(const Option& o)
+{
+	string name = o;
+
+	TT.set_shared(name == "<empty>" ? "" : name);
+	sync_cout << "info string Hash: " << TT.memory_info() << sync_endl;
+}
+
 
 /// Our case insensitive less() function as required by UCI protocol
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const 
@@ -40,8 +61,14 @@ void init(OptionsMap& o)
 	o["Debug Log File"] << Option("", on_logger);
 	o["Contempt"] << Option(0, -100, 100);
 	o["Threads"] << Option(1, 1, 128, on_threads);
+	o["Bind Threads"] << Option(false, on_threads);
 	o["Hash"] << Option(128, 1, MaxHashMB, on_hash_size);
 	o["Clear Hash"] << Option(on_clear_hash);
+	o["Large Pages"] << Option(true, on_hash_memory);
+	o["Hash NUMA"] << Option("Default var Default var Interleave var FirstTouch", "Default", on_hash_memory);
+	o["Shared Hash"] << Option("<empty>", on_shared_hash);
+	o["QSearch Hash"] << Option(false, on_threads);
+	o["Eval Cache"] << Option(0, 0, 65536, on_threads);
 	o["Ponder"] << Option(false);
 	o["MultiPV"] << Option(1, 1, 500);
 	o["Skill Level"] << Option(20, 0, 20);
@@ -49,6 +76,8 @@ void init(OptionsMap& o)
 	o["Minimum Thinking Time"] << Option(20, 0, 5000);
 	o["Slow Mover"] << Option(89, 10, 1000);
 	o["nodestime"] << Option(0, 0, 10000);	
+	o["PEXT Slider Tables"] << Option(false, on_pext_sliders);
+	o["AVX2 Move Scoring"] << Option(false, on_avx2_scoring);
 }
 
 
@@ -85,6 +114,11 @@ Option::Option(const char* v, OnChange f) : type("string"), min(0), max(0), on_c
 	defaultValue = currentValue = v;
 }
 
+Option::Option(const char* v, const char* cur, OnChange f) : type("combo"), min(0), max(0), on_change(f)
+{
+	defaultValue = v; currentValue = cur;
+}
+
 Option::Option(bool v, OnChange f) : type("check"), min(0), max(0), on_change(f)
 {
 	defaultValue = currentValue = (v ? "true" : "false");
@@ -106,10 +140,17 @@ Option::operator int() const
 
 Option::operator std::string() const 
 {
-	assert(type == "string");
+	assert(type == "string" || type == "combo");
 	return currentValue;
 }
 
+bool Option::operator==(const char* s) const
+{
+	assert(type == "combo");
+	return    !CaseInsensitiveLess()(currentValue, s)
+		   && !CaseInsensitiveLess()(s, currentValue);
+}
+
 
 /// operator<<() inits options and assigns idx in the correct printing order
 
@@ -137,6 +178,20 @@ Option& Option::operator=(const string& v)
 		|| (type == "spin" && (stoi(v) < min || stoi(v) > max)))
 		return *this;
 
+	// A combo value must be one of the "var" entries of its default value
+	if (type == "combo")
+	{
+		OptionsMap comboMap; // To have case insensitive compare
+		string token;
+		std::istringstream ss(defaultValue);
+
+		while (ss >> token)
+			comboMap[token] << Option();
+
+		if (!comboMap.count(v) || v == "var")
+			return *this;
+	}
+
 	if (type != "button")
 		currentValue = v;
 